@@ -27,7 +27,14 @@
 #ifndef _LIBDEVQ_H_
 #define _LIBDEVQ_H_
 
-#define	DEVQ_MAX_DEVS	16
+#define	DEVQ_MAX_DEVS	16	/* unused, kept for compatibility */
+#define	DEVQ_DEVNAME_MAX	64
+
+/* Flags of devq_event_monitor_set_flags() */
+#define	DEVQ_EVMON_REGISTRY	0x0001	/* keep track of attached devices */
+#define	DEVQ_EVMON_RAWFD	0x0002	/* get_fd() returns the socket itself */
+#define	DEVQ_EVMON_NONBLOCK	0x0004	/* read() fails with EAGAIN, not wait */
+#define	DEVQ_EVMON_ASYNC_IDS	0x0008	/* look vendors/products up apart */
 
 typedef enum {
 	DEVQ_ATTACHED = 1U,
@@ -51,11 +58,55 @@ typedef enum {
 } devq_class_t;
 
 struct devq_evmon;
+struct devq_evsub;
 struct devq_event;
 struct devq_device;
 
+typedef void	(*devq_handler_t)(struct devq_event *, void *ctx);
+
+struct devq_devinfo {
+	char		path[DEVQ_DEVNAME_MAX];
+	char		driver[DEVQ_DEVNAME_MAX];
+	devq_device_t	type;
+	devq_class_t	class;
+	int		vendor_id;	/* -1 if unknown */
+	int		product_id;	/* -1 if unknown */
+};
+
+/* Fields of struct devq_drm_info that are set */
+#define	DEVQ_DRM_INFO_PATH	0x0001
+#define	DEVQ_DRM_INFO_BUSADDR	0x0002
+#define	DEVQ_DRM_INFO_PCIID	0x0004
+
+struct devq_drm_info {
+	int		valid;		/* DEVQ_DRM_INFO_* */
+	int		dri;		/* $n in hw.dri.$n */
+	char		path[DEVQ_DEVNAME_MAX];
+	char		driver[DEVQ_DEVNAME_MAX];
+	int		domain;
+	int		bus;
+	int		slot;
+	int		function;
+	int		vendor_id;
+	int		device_id;
+	int		subvendor_id;
+	int		subdevice_id;
+	int		revision_id;
+};
+
+struct devq_evmon_stats {
+	unsigned long	reads;		/* reads on the socket */
+	unsigned long	polls;		/* waits in devq_event_monitor_poll() */
+	unsigned long	events;		/* events returned */
+	unsigned long	allocs;		/* heap allocations for events */
+	unsigned long	filtered;	/* lines dropped by filters */
+	unsigned long	dropped;	/* events lost, subscriber too slow */
+};
+
 int		devq_device_get_devpath_from_fd(int fd,
 		    char *path, size_t *path_len);
+int		devq_device_get_devpaths_from_fds(const int *fds,
+		    size_t nfds, char **paths, size_t *paths_len);
 int		devq_device_get_pciid_from_fd(int fd,
 		    int *vendor_id, int *device_id);
 int		devq_device_get_pciid_full_from_fd(int fd,
@@ -69,20 +120,77 @@ int		devq_device_get_pcibusaddr(int fd,
 
 int		devq_device_drm_get_drvname_from_fd(int fd,
 		    char *driver_name, size_t *driver_name_len);
+int		devq_device_drm_get_info(int fd,
+		    struct devq_drm_info *info);
+int		devq_register_driver_type(const char *driver,
+		    devq_device_t type, devq_class_t class);
 devq_device_t	devq_device_get_type(struct devq_device *);
 devq_class_t	devq_device_get_class(struct devq_device *);
 const char *	devq_device_get_path(struct devq_device *);
 const char *	devq_device_get_product(struct devq_device *);
 const char *	devq_device_get_vendor(struct devq_device *);
+const char *	devq_device_get_name(struct devq_device *, size_t *len);
+const char *	devq_device_get_driver(struct devq_device *, size_t *len);
+const char *	devq_device_get_vendor_id(struct devq_device *, size_t *len);
+const char *	devq_device_get_product_id(struct devq_device *, size_t *len);
+
+int		devq_ids_build_cache(const char *ids_path,
+		    const char *cache_path);
 
 struct devq_evmon *	devq_event_monitor_init(void);
+struct devq_evmon *	devq_event_monitor_init_fd(int fd);
 void			devq_event_monitor_fini(struct devq_evmon *);
 int			devq_event_monitor_get_fd(struct devq_evmon *);
+int			devq_event_monitor_add_filter(struct devq_evmon *,
+			    devq_event_t type, devq_class_t class,
+			    const char *driver, const char *attrs);
+void			devq_event_monitor_clear_filters(struct devq_evmon *);
+int			devq_event_monitor_on(struct devq_evmon *,
+			    devq_event_t type, devq_class_t class,
+			    devq_handler_t cb, void *ctx);
+int			devq_event_monitor_get_flags(struct devq_evmon *);
+int			devq_event_monitor_set_flags(struct devq_evmon *,
+			    int flags);
+int			devq_event_monitor_find_device(struct devq_evmon *,
+			    const char *path, struct devq_devinfo *info);
+int			devq_event_monitor_list_devices(struct devq_evmon *,
+			    devq_device_t type, devq_class_t class,
+			    const char *driver, struct devq_devinfo *infos,
+			    size_t max);
+int			devq_event_monitor_get_stats(struct devq_evmon *,
+			    struct devq_evmon_stats *);
 int			devq_event_monitor_poll(struct devq_evmon *);
+int			devq_event_monitor_poll_timeout(struct devq_evmon *,
+			    int timeout);
 struct devq_event *	devq_event_monitor_read(struct devq_evmon *);
+int			devq_event_monitor_read_batch(struct devq_evmon *,
+			    struct devq_event **events, size_t max);
+int			devq_event_monitor_dispatch(struct devq_evmon *,
+			    size_t max);
+int			devq_event_monitor_on_resolved(struct devq_evmon *,
+			    devq_handler_t cb, void *ctx);
+struct devq_event *	devq_event_monitor_read_resolved(struct devq_evmon *);
+
+struct devq_evsub *	devq_event_monitor_subscribe(struct devq_evmon *,
+			    size_t depth);
+void			devq_event_unsubscribe(struct devq_evsub *);
+int			devq_event_subscriber_get_fd(struct devq_evsub *);
+int			devq_event_subscriber_add_filter(struct devq_evsub *,
+			    devq_event_t type, devq_class_t class,
+			    const char *driver, const char *attrs);
+int			devq_event_subscriber_poll(struct devq_evsub *,
+			    int timeout);
+struct devq_event *	devq_event_subscriber_read(struct devq_evsub *);
+int			devq_event_subscriber_get_stats(struct devq_evsub *,
+			    struct devq_evmon_stats *);
 struct devq_device *	devq_event_get_device(struct devq_event *);
 devq_event_t		devq_event_get_type(struct devq_event *);
 const char *		devq_event_dump(struct devq_event *);
+const char *		devq_event_get_attr(struct devq_event *,
+			    const char *key);
+int			devq_event_attr_next(struct devq_event *,
+			    unsigned int *iter, const char **key,
+			    const char **value);
 void			devq_event_free(struct devq_event *);
 
 #endif /* _LIBDEVQ_H_ */
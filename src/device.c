@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2014 Jean-Sebastien Pedron <dumbbell@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Device queries common to every OS, built on the per-OS DRM node
+ * lookup (_devq_drm_node_from_fd()).
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include "libdevq.h"
+#include "devq_private.h"
+
+int
+devq_device_get_pcibusaddr(int fd, int *domain,
+	int *bus, int *slot, int *function)
+{
+	int ret;
+	struct devq_drm_node node;
+
+	/*
+	 * FIXME: This function is specific to DRM devices.
+	 */
+
+	ret = _devq_drm_node_from_fd(fd, &node);
+	if (ret != 0)
+		return (-1);
+
+	if (node.busaddr_error != 0) {
+		errno = node.busaddr_error;
+		return (-1);
+	}
+
+	*domain = node.domain;
+	*bus = node.bus;
+	*slot = node.slot;
+	*function = node.function;
+
+	return (0);
+}
+
+int
+devq_device_get_pciid_full_from_fd(int fd,
+    int *vendor_id, int *device_id, int *subvendor_id,
+    int *subdevice_id, int *revision_id)
+{
+	int ret;
+	struct devq_drm_node node;
+
+	/*
+	 * FIXME: This function is specific to DRM devices.
+	 */
+
+	ret = _devq_drm_node_from_fd(fd, &node);
+	if (ret != 0)
+		return (-1);
+
+	if (node.pciid_error != 0) {
+		errno = node.pciid_error;
+		return (-1);
+	}
+
+	*vendor_id = node.vendor_id;
+	*device_id = node.device_id;
+	*subvendor_id = node.subvendor_id;
+	*subdevice_id = node.subdevice_id;
+	*revision_id = node.revision_id;
+
+	return (0);
+}
+
+int
+devq_device_get_pciid_from_fd(int fd,
+    int *vendor_id, int *device_id)
+{
+	int subvendor_id, subdevice_id, revision_id;
+
+	return devq_device_get_pciid_full_from_fd(fd,
+		vendor_id, device_id, &subvendor_id,
+		&subdevice_id, &revision_id);
+}
+
+int
+devq_device_drm_get_drvname_from_fd(int fd,
+    char *driver_name, size_t *driver_name_len)
+{
+	int ret;
+	struct devq_drm_node node;
+
+	ret = _devq_drm_node_from_fd(fd, &node);
+	if (ret != 0)
+		return (-1);
+
+	if (driver_name != NULL) {
+		if (*driver_name_len < node.driver_len) {
+			*driver_name_len = node.driver_len;
+			errno = ENOMEM;
+			return (-1);
+		}
+
+		memcpy(driver_name, node.driver, node.driver_len);
+	}
+	if (driver_name_len)
+		*driver_name_len = node.driver_len;
+
+	/*
+	 * Return the number of the device: $number in hw.dri.$number on
+	 * FreeBSD, in /dev/dri/card$number on Linux.
+	 */
+	return (node.dri);
+}
+
+int
+devq_device_drm_get_info(int fd, struct devq_drm_info *info)
+{
+	int ret;
+	size_t len;
+	struct devq_drm_node node;
+
+	ret = _devq_drm_node_from_fd(fd, &node);
+	if (ret != 0)
+		return (-1);
+
+	memset(info, 0, sizeof(*info));
+	info->dri = node.dri;
+	memcpy(info->driver, node.driver, node.driver_len);
+
+	len = sizeof(info->path) - 1;
+	if (devq_device_get_devpath_from_fd(fd, info->path, &len) == 0) {
+		info->path[len] = '\0';
+		info->valid |= DEVQ_DRM_INFO_PATH;
+	}
+
+	if (node.busaddr_error == 0) {
+		info->domain = node.domain;
+		info->bus = node.bus;
+		info->slot = node.slot;
+		info->function = node.function;
+		info->valid |= DEVQ_DRM_INFO_BUSADDR;
+	}
+
+	if (node.pciid_error == 0) {
+		info->vendor_id = node.vendor_id;
+		info->device_id = node.device_id;
+		info->subvendor_id = node.subvendor_id;
+		info->subdevice_id = node.subdevice_id;
+		info->revision_id = node.revision_id;
+		info->valid |= DEVQ_DRM_INFO_PCIID;
+	}
+
+	return (0);
+}
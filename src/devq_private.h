@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2014 Jean-Sebastien Pedron <dumbbell@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Interfaces shared between the source files of the library. Nothing
+ * here is exported: only devq_* symbols are.
+ */
+
+#ifndef _DEVQ_PRIVATE_H_
+#define _DEVQ_PRIVATE_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "libdevq.h"
+
+#if !defined(HAVE_STRLCPY)
+size_t	strlcpy(char *dst, const char *src, size_t size);
+#endif
+#if !defined(HAVE_REALLOCF)
+void	*reallocf(void *ptr, size_t size);
+#endif
+
+/*
+ * The pci.ids and usb.ids databases, and their caches built by
+ * devq_ids_build_cache(). The checks build the library with their own.
+ */
+#if !defined(DEVQ_PCIIDS_PATH)
+#if defined(__linux__)
+#define	DEVQ_PCIIDS_PATH	"/usr/share/misc/pci.ids"
+#define	DEVQ_USBIDS_PATH	"/usr/share/misc/usb.ids"
+#else
+#define	DEVQ_PCIIDS_PATH	PREFIX "/share/pciids/pci.ids"
+#define	DEVQ_USBIDS_PATH	PREFIX "/share/usbids/usb.ids"
+#endif
+#endif
+#define	DEVQ_PCIIDS_CACHE	PREFIX "/share/libdevq/pci.ids.cache"
+#define	DEVQ_USBIDS_CACHE	PREFIX "/share/libdevq/usb.ids.cache"
+
+/*
+ * A walk over the children of a sysctl node numbered $n, name.$n, in
+ * the order of the kernel. Zeroed before the first step.
+ */
+#define	DEVQ_SYSCTL_MAXNAME	24
+
+struct devq_sysctl_iter {
+	int	mib[DEVQ_SYSCTL_MAXNAME];	/* of the node */
+	size_t	miblen;				/* 0 before the first step */
+	int	child;				/* oid of the last child */
+};
+
+/*
+ * A display-class PCI function, as listed by the PCI bus.
+ */
+struct devq_pci_func {
+	int	domain;
+	int	bus;
+	int	slot;
+	int	function;
+	int	vendor_id;
+	int	device_id;
+	int	subvendor_id;
+	int	subdevice_id;
+	int	revision_id;
+};
+
+/*
+ * The system interfaces used by the device query functions.
+ */
+struct devq_backend {
+	int	(*sysctlbyname)(const char *name, void *oldp,
+		    size_t *oldlenp, const void *newp, size_t newlen);
+	int	(*sysctlnametomib)(const char *name, int *mibp,
+		    size_t *sizep);
+	int	(*sysctl)(const int *name, u_int namelen, void *oldp,
+		    size_t *oldlenp, const void *newp, size_t newlen);
+	int	(*fstat)(int fd, struct stat *st);
+	/* Absolute path of the file opened as fd, NUL-terminated. */
+	int	(*fd_path)(int fd, char *path, size_t path_size);
+	/*
+	 * The same for several descriptors at once: found() is called with
+	 * the index in fds of each descriptor whose path is known.
+	 */
+	int	(*fd_paths)(const int *fds, size_t nfds,
+		    void (*found)(void *arg, size_t i, const char *path),
+		    void *arg);
+	/*
+	 * Store $n of the next child of the sysctl node name in index.
+	 * Fails with ENOENT after the last one.
+	 */
+	int	(*sysctl_iter)(struct devq_sysctl_iter *it, const char *name,
+		    int *index);
+	/*
+	 * Store up to *nfuncs display-class PCI functions in funcs and
+	 * their total number in *nfuncs.
+	 */
+	int	(*pci_funcs)(struct devq_pci_func *funcs, size_t *nfuncs);
+};
+
+extern const struct devq_backend *_devq_backend;
+
+/*
+ * pci_funcs of the FreeBSD backend, over getconf, a PCIOCGETCONF on
+ * /dev/pci. The list is read again from the start when it changes
+ * under it, up to DEVQ_PCI_RETRIES times before failing with EAGAIN.
+ */
+#define	DEVQ_PCI_RETRIES	4
+
+struct pci_conf_io;
+
+int	_devq_pci_getconf_funcs(int (*getconf)(void *arg,
+	    struct pci_conf_io *pc), void *arg, struct devq_pci_func *funcs,
+	    size_t *nfuncs);
+
+/*
+ * A DRM device, as found under hw.dri.$n and dev.vgapci.$m.
+ */
+struct devq_drm_node {
+	dev_t	rdev;			/* st_rdev of the device node */
+	int	dri;			/* $n in hw.dri.$n */
+	char	driver[DEVQ_DEVNAME_MAX];
+	size_t	driver_len;
+
+	int	busaddr_error;		/* errno if the fields below are unset */
+	int	domain;
+	int	bus;
+	int	slot;
+	int	function;
+
+	int	pciid_error;		/* errno if the fields below are unset */
+	int	vgapci;			/* $m in dev.vgapci.$m */
+	int	vendor_id;
+	int	device_id;
+	int	subvendor_id;
+	int	subdevice_id;
+	int	revision_id;
+};
+
+/*
+ * The system side of an event monitor: where the stream of events comes
+ * from and how to wait for it. Whatever the system, the stream is read
+ * as devd(8) lines, "+name at key=value ...", "-name ..." or
+ * "!system=... ", that _devq_evmon_os_recv() puts into the receive
+ * buffer of the monitor.
+ *
+ * _devq_evmon_os_wait() waits up to timeout milliseconds, forever if
+ * negative, and returns 1 if the stream is readable, 0 on timeout or -1
+ * on error. Without a stream, fd -1, only _devq_evmon_os_wakeup() ends
+ * the wait.
+ */
+struct devq_evmon_os;
+
+int	_devq_evmon_os_connect(void);
+struct devq_evmon_os *
+	_devq_evmon_os_init(int fd, size_t *recv_min);
+void	_devq_evmon_os_fini(struct devq_evmon_os *os);
+int	_devq_evmon_os_fd(struct devq_evmon_os *os);
+int	_devq_evmon_os_wait(struct devq_evmon_os *os, int timeout);
+void	_devq_evmon_os_wakeup(struct devq_evmon_os *os);
+ssize_t	_devq_evmon_os_recv(struct devq_evmon_os *os, char *buf, size_t len,
+	    int nonblock);
+
+int	_devq_drm_node_from_fd(int fd, struct devq_drm_node *node);
+void	_devq_drm_invalidate(void);
+unsigned int
+	_devq_drm_generation(void);
+int	_devq_drm_event(const char *line, size_t len);
+
+#endif /* _DEVQ_PRIVATE_H_ */
@@ -0,0 +1,3081 @@
+/*
+ * Copyright (c) 2014 Baptiste Daroussin <bapt@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ctype.h>
+
+#include "libdevq.h"
+#include "devq_private.h"
+
+struct hw_type {
+	const char *driver;
+	devq_device_t type;
+	devq_class_t class;
+};
+
+static const struct hw_type hw_types[] = {
+	{ "ukbd",  DEVQ_DEVICE_KEYBOARD,     DEVQ_CLASS_INPUT   },
+	{ "atkbd", DEVQ_DEVICE_KEYBOARD,     DEVQ_CLASS_INPUT   },
+	{ "ums",   DEVQ_DEVICE_MOUSE,        DEVQ_CLASS_INPUT   },
+	{ "psm",   DEVQ_DEVICE_MOUSE,        DEVQ_CLASS_INPUT   },
+	{ "uhid",  DEVQ_DEVICE_MOUSE,        DEVQ_CLASS_INPUT   },
+	{ "joy",   DEVQ_DEVICE_JOYSTICK,     DEVQ_CLASS_INPUT   },
+	{ "atp",   DEVQ_DEVICE_TOUCHPAD,     DEVQ_CLASS_INPUT   },
+	{ "uep",   DEVQ_DEVICE_TOUCHSCREEN,  DEVQ_CLASS_INPUT   },
+#if defined(__linux__)
+	{ "input/mouse", DEVQ_DEVICE_MOUSE,    DEVQ_CLASS_INPUT   },
+	{ "input/js",    DEVQ_DEVICE_JOYSTICK, DEVQ_CLASS_INPUT   },
+	{ "input/event", DEVQ_DEVICE_UNKNOWN,  DEVQ_CLASS_INPUT   },
+#endif
+	{ NULL,	   DEVQ_DEVICE_UNKNOWN,      DEVQ_CLASS_UNKNOWN },
+};
+
+/*
+ * Driver classification table: hw_types[] plus the drivers registered
+ * with devq_register_driver_type(), in an open-addressing hash keyed by
+ * driver name. It is built on first use and only grows.
+ */
+struct hw_table {
+	pthread_rwlock_t lock;
+	struct hw_type *slots;
+	size_t mask;
+	size_t count;
+};
+
+#define HW_MIN_SLOTS	32
+
+static struct hw_table hw_table = { .lock = PTHREAD_RWLOCK_INITIALIZER };
+
+#define DEVQ_RECVBUF_SIZE	8192
+#define DEVQ_RESOLVERS		2	/* threads of DEVQ_EVMON_ASYNC_IDS */
+
+#define DEVD_EVENT_ATTACH	'+'
+#define DEVD_EVENT_DETTACH	'-'
+#define DEVD_EVENT_NOTICE	'!'
+#define DEVD_EVENT_UNKNOWN	'?'
+
+/*
+ * Attributes of an event line, found in one pass: key=value pairs
+ * (value possibly quoted) and bare keywords such as "on", which take the
+ * following word as their value. Offsets are relative to the start of
+ * the line and the table is indexed by a small open-addressing hash.
+ */
+#define DEVQ_MAX_ATTRS		40
+#define DEVQ_ATTR_SLOTS		64	/* power of 2, > DEVQ_MAX_ATTRS */
+
+struct devq_attr {
+	uint32_t key_off;
+	uint32_t key_len;
+	uint32_t val_off;
+	uint32_t val_len;
+};
+
+struct devq_attrs {
+	size_t name_off;	/* device name of +/- lines */
+	size_t name_len;
+	unsigned int n;
+	struct devq_attr attr[DEVQ_MAX_ATTRS];
+	uint8_t index[DEVQ_ATTR_SLOTS];	/* attr index + 1, 0 if empty */
+};
+
+/*
+ * A filter compiled by devq_event_monitor_add_filter(). A line is kept
+ * if it matches any filter; all the criteria of a filter must match.
+ */
+struct devq_filter_attr {
+	const char *key;
+	size_t key_len;
+	uint32_t hash;
+	const char *val;	/* NULL if only the presence of key matters */
+	size_t val_len;
+};
+
+struct devq_filter {
+	struct devq_filter *next;
+	devq_event_t type;	/* 0 for any */
+	devq_class_t class;	/* 0 for any */
+	char *driver;		/* prefix of the device name, or NULL */
+	size_t driver_len;
+	unsigned int nattrs;
+	struct devq_filter_attr *attrs;
+	char *buf;		/* storage for driver, keys and values */
+};
+
+/*
+ * A handler registered with devq_event_monitor_on(), called by
+ * devq_event_monitor_dispatch() for the events of its type and class.
+ */
+struct devq_handler {
+	struct devq_handler *next;
+	devq_event_t type;	/* 0 for any */
+	devq_class_t class;	/* 0 for any */
+	devq_handler_t cb;
+	void *ctx;
+};
+
+/*
+ * Devices currently attached, as seen from the attach/detach events read
+ * from the monitor. There is a single writer, the thread reading the
+ * monitor, and any number of readers: readers copy entries out and
+ * retry if the sequence number was odd or changed meanwhile. Tables
+ * replaced when growing are kept until the monitor is freed, as readers
+ * may still be looking at them.
+ */
+struct reg_entry {
+	int state;
+	struct devq_devinfo info;
+};
+
+#define REG_EMPTY	0
+#define REG_USED	1
+#define REG_DELETED	2
+#define REG_MIN_SLOTS	64
+
+struct reg_table {
+	struct reg_table *retired;
+	size_t mask;
+	size_t used;		/* used and deleted slots */
+	struct reg_entry slots[];
+};
+
+struct devq_registry {
+	atomic_uint seq;
+	_Atomic(struct reg_table *) table;
+};
+
+/*
+ * A subscriber of a shared monitor. The reader thread of the monitor is
+ * the only producer of its ring and the subscriber the only consumer.
+ */
+struct devq_evsub {
+	struct devq_evsub *next;
+	struct devq_evmon *evm;
+	struct devq_evmon_os *os;	/* woken when the ring gets an event */
+	struct devq_filter *filters;
+	struct devq_evmon_stats stats;
+	atomic_size_t head;	/* next event to read */
+	atomic_size_t tail;	/* next free slot */
+	size_t mask;
+	struct devq_event *ring[];
+};
+
+struct devq_evmon {
+	int fd;
+	struct devq_evmon_os *os;
+	int fd_user;	/* the caller waits on the monitor descriptor */
+	char *buf;	/* receive buffer */
+	size_t len;	/* allocated size of buf */
+	size_t off;	/* start of the data not yet returned */
+	size_t end;	/* end of the data read from fd */
+	size_t recv_min;	/* free space needed by a read */
+	struct devq_evmon_stats stats;
+	int flags;
+	struct devq_filter *filters;
+	struct devq_handler *handlers;	/* in the order registered */
+	unsigned int handled;	/* 1 << type of the handlers, 1 for any */
+	struct devq_registry *registry;
+	struct devq_attrs scratch;	/* attributes of the line prepared */
+	int scratch_valid;
+
+	/*
+	 * Once the monitor has subscribers, a thread reads it and hands the
+	 * events out to them. The lock covers the list of subscribers, their
+	 * filters and the counters updated by the thread.
+	 */
+	pthread_mutex_t hub_lock;
+	struct devq_evsub *subs;
+	pthread_t hub_thread;
+	int hub_running;
+	atomic_int hub_stop;
+	atomic_int hub_done;	/* end of the stream, or error */
+	int hub_error;		/* errno at the end, 0 if none */
+
+	/*
+	 * With DEVQ_EVMON_ASYNC_IDS, worker threads look up the vendor and
+	 * product names of the events queued, then hand them to res_cb or
+	 * queue them again for devq_event_monitor_read_resolved().
+	 */
+	pthread_mutex_t res_lock;
+	pthread_cond_t res_cond;
+	pthread_t res_threads[DEVQ_RESOLVERS];
+	int res_nthreads;
+	int res_stop;
+	struct devq_event *res_jobs;
+	struct devq_event **res_jobs_tail;
+	struct devq_event *res_done;
+	struct devq_event **res_done_tail;
+	atomic_uint res_ndone;
+	devq_handler_t res_cb;
+	void *res_ctx;
+
+	/*
+	 * Events released by devq_event_free() are kept here, with their
+	 * device and string buffers, to be handed out again. The monitor
+	 * itself is only freed once all its events have been released.
+	 */
+	pthread_mutex_t pool_lock;
+	struct devq_event *pool;
+	unsigned int npool;
+	unsigned int outstanding;
+	int closing;
+};
+
+/* A string buffer reused across events */
+struct devq_str {
+	char *buf;
+	size_t cap;
+};
+
+/*
+ * The name, driver and vendor/product IDs of a device are views into
+ * the raw line of its event, given as offset and length. The path and
+ * the vendor/product names are only built when asked for.
+ */
+struct devq_device {
+	devq_device_t type;
+	devq_class_t class;
+	struct devq_event *event;
+	size_t name_off;
+	size_t name_len;
+	size_t driver_len;	/* the driver is a prefix of the name */
+	size_t vendor_off;
+	size_t vendor_len;	/* 0 if there is no vendor= */
+	size_t product_off;
+	size_t product_len;	/* 0 if there is no product= */
+	atomic_int resolved;
+	char *path;
+	char *vendor;
+	char *product;
+	struct devq_str pathbuf;
+	struct devq_str vendorbuf;
+	struct devq_str productbuf;
+};
+
+/*
+ * An event given to the subscribers of a shared monitor is handed out
+ * with everything but the vendor and product names built, and is freed
+ * by the last of them.
+ */
+struct devq_event {
+	int type;
+	atomic_uint refs;
+	int shared;
+	int async;		/* names looked up by the resolver threads */
+	struct devq_event *rnext;	/* in the resolver queues */
+	struct devq_device *device;
+	char *raw;
+	struct devq_evmon *evm;
+	struct devq_event *next;
+	struct devq_str rawbuf;
+	struct devq_attrs attrs;
+	char *attrstr;		/* raw with keys and values terminated */
+	struct devq_str attrbuf;
+	struct devq_device dev;
+};
+
+#define DEVQ_POOL_MAX	64
+
+static int	resolver_start(struct devq_evmon *evm);
+static void	resolver_stop(struct devq_evmon *evm);
+static void	resolver_submit(struct devq_evmon *evm, struct devq_event *e);
+
+/*
+ * In-memory index of a pci.ids/usb.ids database, shared by all monitors
+ * of the process. Vendors are keyed by their ID, products by
+ * (vendor << 16 | product).
+ */
+struct ids_slot {
+	uint32_t key;
+	int product;
+	const char *name;
+};
+
+/*
+ * Precompiled form of a database, built by devq_ids_build_cache() and
+ * mapped read-only: a header, the entries sorted by key, then the
+ * NUL-terminated names. The header records the mtime and size of the
+ * text file it was built from, so a stale cache can be detected.
+ */
+#define IDS_CACHE_MAGIC		0x49515644	/* "DVQI" */
+#define IDS_CACHE_VERSION	1
+
+struct ids_cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	int64_t src_mtime_sec;
+	int64_t src_mtime_nsec;
+	int64_t src_size;
+	uint64_t nentries;
+	uint64_t strsize;
+};
+
+struct ids_cache_entry {
+	uint64_t key;		/* product << 32 | ID */
+	uint64_t name;		/* offset in the string table */
+};
+
+struct ids_db {
+	const char *path;
+	const char *cache_path;
+	char *data;
+	struct ids_slot *slots;
+	size_t mask;
+	size_t count;
+	struct timespec mtime;
+	off_t size;
+	void *map;
+	size_t maplen;
+	const struct ids_cache_entry *entries;
+	uint64_t nentries;
+	const char *strings;
+	time_t checked;
+};
+
+#define IDS_MIN_SLOTS		4096
+#define IDS_CHECK_INTERVAL	1
+
+static pthread_mutex_t ids_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ids_db usbids = {
+	.path = DEVQ_USBIDS_PATH,
+	.cache_path = DEVQ_USBIDS_CACHE,
+};
+static struct ids_db pciids = {
+	.path = DEVQ_PCIIDS_PATH,
+	.cache_path = DEVQ_PCIIDS_CACHE,
+};
+
+static int
+socket_pending(struct devq_evmon *evm)
+{
+
+	return (memchr(evm->buf + evm->off, '\n', evm->end - evm->off) != NULL);
+}
+
+/*
+ * Return the next complete line of the receive buffer, without its line
+ * break, or NULL if more data must be read first.
+ */
+static char *
+socket_nextline(struct devq_evmon *evm, ssize_t *linelen)
+{
+	char *nl, *line;
+
+	nl = memchr(evm->buf + evm->off, '\n', evm->end - evm->off);
+	if (nl == NULL)
+		return (NULL);
+
+	*nl = '\0';
+	line = evm->buf + evm->off;
+	*linelen = nl - line;
+
+	evm->off += *linelen + 1;
+	if (evm->off == evm->end)
+		evm->off = evm->end = 0;
+
+	return (line);
+}
+
+/*
+ * Read as much as the free space in the receive buffer allows; bytes
+ * following the last complete line are kept for the next call, so a
+ * burst of events costs a single read.
+ */
+static ssize_t
+socket_fill(struct devq_evmon *evm, int nonblock)
+{
+	ssize_t ret;
+
+	if (evm->off > 0) {
+		memmove(evm->buf, evm->buf + evm->off, evm->end - evm->off);
+		evm->end -= evm->off;
+		evm->off = 0;
+	}
+
+	while (evm->len - evm->end < evm->recv_min) {
+		evm->len *= 2;
+		evm->buf = reallocf(evm->buf, evm->len * sizeof(char));
+		if (evm->buf == NULL) {
+			evm->len = evm->end = 0;
+			return (-1);
+		}
+	}
+
+	ret = _devq_evmon_os_recv(evm->os, evm->buf + evm->end,
+	    evm->len - evm->end, nonblock);
+	evm->stats.reads++;
+	if (ret > 0)
+		evm->end += ret;
+
+	return (ret);
+}
+
+static ssize_t
+socket_getline(struct devq_evmon *evm, char **line, int nonblock)
+{
+	ssize_t sz;
+
+	while ((*line = socket_nextline(evm, &sz)) == NULL) {
+		if ((sz = socket_fill(evm, nonblock)) < 1) {
+			if (sz == 0)
+				errno = 0;	/* end of stream */
+			return (-1);
+		}
+	}
+
+	return (sz); /* number of bytes in the line, not counting the line break*/
+}
+
+/*
+ * Return the next line of a batch: the lines already buffered, then those
+ * of a single non-blocking read. At the end of the batch, return NULL and
+ * set *sz to 0, or to -1 at the end of the stream or on error.
+ */
+static char *
+socket_batchline(struct devq_evmon *evm, int *filled, ssize_t *sz)
+{
+	char *line;
+
+	while ((line = socket_nextline(evm, sz)) == NULL) {
+		if (*filled) {
+			*sz = 0;
+			return (NULL);
+		}
+		*filled = 1;
+		if ((*sz = socket_fill(evm, 1)) > 0)
+			continue;
+		if (*sz == 0) {
+			errno = 0;	/* end of stream */
+			*sz = -1;
+		} else if (errno == EAGAIN)
+			*sz = 0;
+		return (NULL);
+	}
+
+	return (line);
+}
+
+static void
+socket_notify(struct devq_evmon *evm)
+{
+
+	if (evm->fd_user && socket_pending(evm))
+		_devq_evmon_os_wakeup(evm->os);
+}
+
+static uint32_t
+attr_hash(const char *key, size_t len)
+{
+	uint32_t h;
+
+	for (h = 2166136261u; len > 0; len--)
+		h = (h ^ (unsigned char)*key++) * 16777619u;
+
+	return (h);
+}
+
+static const struct devq_attr *
+attrs_find_hash(const struct devq_attrs *a, const char *line,
+    const char *key, size_t len, uint32_t h)
+{
+	const struct devq_attr *attr;
+
+	for (; a->index[h % DEVQ_ATTR_SLOTS] != 0; h++) {
+		attr = &a->attr[a->index[h % DEVQ_ATTR_SLOTS] - 1];
+		if (attr->key_len == len &&
+		    memcmp(line + attr->key_off, key, len) == 0)
+			return (attr);
+	}
+
+	return (NULL);
+}
+
+static const struct devq_attr *
+attrs_find(const struct devq_attrs *a, const char *line, const char *key,
+    size_t len)
+{
+
+	return (attrs_find_hash(a, line, key, len, attr_hash(key, len)));
+}
+
+static struct devq_attr *
+attrs_add(struct devq_attrs *a, const char *line, const char *key,
+    size_t len)
+{
+	struct devq_attr *attr;
+	uint32_t h;
+
+	if (a->n == DEVQ_MAX_ATTRS)
+		return (NULL);
+
+	for (h = attr_hash(key, len); a->index[h % DEVQ_ATTR_SLOTS] != 0; h++) {
+		attr = &a->attr[a->index[h % DEVQ_ATTR_SLOTS] - 1];
+		if (attr->key_len == len &&
+		    memcmp(line + attr->key_off, key, len) == 0)
+			return (NULL);	/* the first occurrence wins */
+	}
+
+	attr = &a->attr[a->n++];
+	a->index[h % DEVQ_ATTR_SLOTS] = a->n;
+	attr->key_off = key - line;
+	attr->key_len = len;
+	attr->val_off = attr->key_off + len;
+	attr->val_len = 0;
+
+	return (attr);
+}
+
+static void
+attrs_parse(struct devq_attrs *a, const char *line, size_t len)
+{
+	struct devq_attr *attr, *bare;
+	const char *p, *end, *tok;
+
+	a->n = 0;
+	a->name_off = a->name_len = 0;
+	memset(a->index, 0, sizeof(a->index));
+
+	if (len == 0)
+		return;
+
+	p = line + 1;
+	end = line + len;
+
+	if (*line == DEVD_EVENT_ATTACH || *line == DEVD_EVENT_DETTACH) {
+		for (tok = p; p < end && !isspace(*p); p++)
+			;
+		a->name_off = tok - line;
+		a->name_len = p - tok;
+	}
+
+	bare = NULL;
+	for (;;) {
+		while (p < end && isspace(*p))
+			p++;
+		if (p == end)
+			break;
+
+		for (tok = p; p < end && !isspace(*p) && *p != '='; p++)
+			;
+
+		if (p == end || *p != '=') {
+			/* "on uhub0", but "at" is followed by the location */
+			if (bare != NULL) {
+				bare->val_off = tok - line;
+				bare->val_len = p - tok;
+				bare = NULL;
+			} else {
+				bare = attrs_add(a, line, tok, p - tok);
+				if (bare != NULL && bare->key_len == 2 &&
+				    memcmp(tok, "at", 2) == 0)
+					bare = NULL;
+			}
+			continue;
+		}
+
+		bare = NULL;
+		attr = attrs_add(a, line, tok, p - tok);
+		p++;
+		if (p < end && *p == '"') {
+			for (tok = ++p; p < end && *p != '"'; p++)
+				;
+			if (attr != NULL) {
+				attr->val_off = tok - line;
+				attr->val_len = p - tok;
+			}
+			if (p < end)
+				p++;
+		} else {
+			for (tok = p; p < end && !isspace(*p); p++)
+				;
+			if (attr != NULL) {
+				attr->val_off = tok - line;
+				attr->val_len = p - tok;
+			}
+		}
+	}
+}
+
+static devq_event_t
+line_type(const char *line)
+{
+
+	switch (*line) {
+	case DEVD_EVENT_ATTACH:
+		return (DEVQ_ATTACHED);
+	case DEVD_EVENT_DETTACH:
+		return (DEVQ_DETACHED);
+	case DEVD_EVENT_NOTICE:
+		return (DEVQ_NOTICE);
+	default:
+		return (DEVQ_UNKNOWN);
+	}
+}
+
+/*
+ * Length of the driver part of a device name, "ums" for "ums0".
+ */
+static size_t
+driver_len(const char *name, size_t len)
+{
+
+	while (len > 0 && isdigit(name[len - 1]))
+		len--;
+
+	return (len);
+}
+
+static struct hw_type *
+hw_table_slot(struct hw_type *slots, size_t mask, const char *driver,
+    size_t len)
+{
+	struct hw_type *slot;
+	uint32_t h;
+
+	for (h = attr_hash(driver, len);; h++) {
+		slot = &slots[h & mask];
+		if (slot->driver == NULL ||
+		    (strncmp(slot->driver, driver, len) == 0 &&
+		    slot->driver[len] == '\0'))
+			return (slot);
+	}
+}
+
+/* Called with the table write-locked */
+static int
+hw_table_insert(const char *driver, devq_device_t type, devq_class_t class,
+    int copy)
+{
+	struct hw_type *slots, *slot;
+	size_t i, len, size;
+
+	if ((hw_table.count + 1) * 2 > hw_table.mask + 1) {
+		size = hw_table.slots != NULL ? (hw_table.mask + 1) * 2 :
+		    HW_MIN_SLOTS;
+		if ((slots = calloc(size, sizeof(*slots))) == NULL)
+			return (-1);
+		for (i = 0; hw_table.slots != NULL && i <= hw_table.mask; i++) {
+			slot = &hw_table.slots[i];
+			if (slot->driver != NULL)
+				*hw_table_slot(slots, size - 1, slot->driver,
+				    strlen(slot->driver)) = *slot;
+		}
+		free(hw_table.slots);
+		hw_table.slots = slots;
+		hw_table.mask = size - 1;
+	}
+
+	len = strlen(driver);
+	slot = hw_table_slot(hw_table.slots, hw_table.mask, driver, len);
+	if (slot->driver == NULL) {
+		if (copy && (driver = strdup(driver)) == NULL)
+			return (-1);
+		slot->driver = driver;
+		hw_table.count++;
+	}
+	slot->type = type;
+	slot->class = class;
+
+	return (0);
+}
+
+/* Called with the table write-locked */
+static int
+hw_table_init(void)
+{
+	int i;
+
+	if (hw_table.slots != NULL)
+		return (0);
+
+	for (i = 0; hw_types[i].driver != NULL; i++) {
+		if (hw_table_insert(hw_types[i].driver, hw_types[i].type,
+		    hw_types[i].class, 0) != 0)
+			return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Classify a device by the driver part of its name.
+ */
+static void
+hw_type_lookup(const char *name, size_t len, devq_device_t *type,
+    devq_class_t *class)
+{
+	struct hw_type *slot;
+	size_t dlen;
+
+	*type = DEVQ_DEVICE_UNKNOWN;
+	*class = DEVQ_CLASS_UNKNOWN;
+
+	dlen = driver_len(name, len);
+	if (dlen == 0 || dlen == len)
+		return;
+
+	pthread_rwlock_rdlock(&hw_table.lock);
+	if (hw_table.slots == NULL) {
+		pthread_rwlock_unlock(&hw_table.lock);
+		pthread_rwlock_wrlock(&hw_table.lock);
+		if (hw_table_init() != 0) {
+			pthread_rwlock_unlock(&hw_table.lock);
+			return;
+		}
+	}
+
+	slot = hw_table_slot(hw_table.slots, hw_table.mask, name, dlen);
+	if (slot->driver != NULL) {
+		*type = slot->type;
+		*class = slot->class;
+	}
+	pthread_rwlock_unlock(&hw_table.lock);
+}
+
+int
+devq_register_driver_type(const char *driver, devq_device_t type,
+    devq_class_t class)
+{
+	size_t len;
+	int ret;
+
+	if (driver == NULL || (len = strlen(driver)) == 0 ||
+	    driver_len(driver, len) != len) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	pthread_rwlock_wrlock(&hw_table.lock);
+	ret = hw_table_init();
+	if (ret == 0)
+		ret = hw_table_insert(driver, type, class, 1);
+	pthread_rwlock_unlock(&hw_table.lock);
+
+	return (ret);
+}
+
+static int
+filter_match(const struct devq_filter *f, devq_event_t type,
+    const char *line, const struct devq_attrs *a)
+{
+	const struct devq_filter_attr *fa;
+	const struct devq_attr *attr;
+	devq_device_t dtype;
+	devq_class_t class;
+	unsigned int i;
+
+	if (f->type != 0 && f->type != type)
+		return (0);
+
+	if (f->driver != NULL && (a->name_len < f->driver_len ||
+	    memcmp(line + a->name_off, f->driver, f->driver_len) != 0))
+		return (0);
+
+	if (f->class != 0) {
+		if (a->name_len == 0)
+			return (0);
+		hw_type_lookup(line + a->name_off, a->name_len, &dtype, &class);
+		if (class != f->class)
+			return (0);
+	}
+
+	for (i = 0; i < f->nattrs; i++) {
+		fa = &f->attrs[i];
+		attr = attrs_find_hash(a, line, fa->key, fa->key_len, fa->hash);
+		if (attr == NULL)
+			return (0);
+		if (fa->val != NULL && (attr->val_len != fa->val_len ||
+		    memcmp(line + attr->val_off, fa->val, fa->val_len) != 0))
+			return (0);
+	}
+
+	return (1);
+}
+
+static int
+filters_match(const struct devq_filter *f, const char *line,
+    const struct devq_attrs *a)
+{
+	devq_event_t type;
+
+	type = line_type(line);
+	for (; f != NULL; f = f->next) {
+		if (filter_match(f, type, line, a))
+			return (1);
+	}
+
+	return (0);
+}
+
+static void
+filters_free(struct devq_filter *f)
+{
+	struct devq_filter *next;
+
+	for (; f != NULL; f = next) {
+		next = f->next;
+		free(f->attrs);
+		free(f->buf);
+		free(f);
+	}
+}
+
+/*
+ * Compile a filter. attrs is a list of "key=value" or "key" words
+ * separated by spaces.
+ */
+static struct devq_filter *
+filter_compile(devq_event_t type, devq_class_t class, const char *driver,
+    const char *attrs)
+{
+	struct devq_filter *f;
+	struct devq_filter_attr *fa;
+	size_t dlen, alen;
+	char *walk, *eq;
+	unsigned int n;
+
+	dlen = driver != NULL ? strlen(driver) : 0;
+	alen = attrs != NULL ? strlen(attrs) : 0;
+
+	if ((f = calloc(1, sizeof(*f))) == NULL)
+		return (NULL);
+	if ((f->buf = malloc(dlen + 1 + alen + 1)) == NULL) {
+		free(f);
+		return (NULL);
+	}
+
+	f->type = type;
+	f->class = class;
+	if (driver != NULL) {
+		f->driver = f->buf;
+		f->driver_len = dlen;
+		memcpy(f->driver, driver, dlen + 1);
+	}
+
+	walk = f->buf + dlen + 1;
+	memcpy(walk, attrs != NULL ? attrs : "", alen + 1);
+
+	for (n = 0, eq = walk; *eq != '\0'; n++) {
+		while (isspace(*eq))
+			eq++;
+		if (*eq == '\0')
+			break;
+		while (*eq != '\0' && !isspace(*eq))
+			eq++;
+	}
+
+	if (n > 0 && (f->attrs = calloc(n, sizeof(*f->attrs))) == NULL) {
+		filters_free(f);
+		return (NULL);
+	}
+
+	for (;;) {
+		while (isspace(*walk))
+			*walk++ = '\0';
+		if (*walk == '\0')
+			break;
+
+		fa = &f->attrs[f->nattrs++];
+		fa->key = walk;
+		while (*walk != '\0' && !isspace(*walk))
+			walk++;
+		if ((eq = memchr(fa->key, '=', walk - fa->key)) != NULL) {
+			fa->val = eq + 1;
+			fa->val_len = walk - fa->val;
+		} else
+			eq = walk;
+		fa->key_len = eq - fa->key;
+		fa->hash = attr_hash(fa->key, fa->key_len);
+	}
+
+	return (f);
+}
+
+static void
+handlers_free(struct devq_handler *h)
+{
+	struct devq_handler *next;
+
+	for (; h != NULL; h = next) {
+		next = h->next;
+		free(h);
+	}
+}
+
+static struct reg_entry *
+reg_slot(struct reg_table *t, const char *path, int insert)
+{
+	struct reg_entry *ent, *tomb;
+	uint32_t h;
+
+	tomb = NULL;
+	for (h = attr_hash(path, strlen(path));; h++) {
+		ent = &t->slots[h & t->mask];
+		if (ent->state == REG_EMPTY)
+			return (insert && tomb != NULL ? tomb : (insert ? ent : NULL));
+		if (ent->state == REG_DELETED) {
+			if (tomb == NULL)
+				tomb = ent;
+			continue;
+		}
+		if (strcmp(ent->info.path, path) == 0)
+			return (ent);
+	}
+}
+
+static struct reg_table *
+reg_table_new(size_t size)
+{
+	struct reg_table *t;
+
+	t = calloc(1, sizeof(*t) + size * sizeof(struct reg_entry));
+	if (t != NULL)
+		t->mask = size - 1;
+
+	return (t);
+}
+
+/*
+ * Called by the writer, inside a write section, to make room for one
+ * more entry.
+ */
+static struct reg_table *
+reg_grow(struct devq_registry *reg)
+{
+	struct reg_table *t, *nt;
+	size_t i, live, size;
+
+	t = atomic_load_explicit(&reg->table, memory_order_relaxed);
+	if ((t->used + 1) * 2 <= t->mask + 1)
+		return (t);
+
+	/* Only rehash at the same size if most used slots are deleted */
+	for (live = 0, i = 0; i <= t->mask; i++)
+		live += (t->slots[i].state == REG_USED);
+	size = (live + 1) * 4 <= t->mask + 1 ? t->mask + 1 : (t->mask + 1) * 2;
+	if ((nt = reg_table_new(size)) == NULL)
+		return (NULL);
+
+	for (i = 0; i <= t->mask; i++) {
+		if (t->slots[i].state != REG_USED)
+			continue;
+		*reg_slot(nt, t->slots[i].info.path, 1) = t->slots[i];
+		nt->used++;
+	}
+	nt->retired = t;
+	atomic_store_explicit(&reg->table, nt, memory_order_release);
+
+	return (nt);
+}
+
+static void
+reg_update(struct devq_registry *reg, devq_event_t type, const char *line,
+    const struct devq_attrs *a)
+{
+	struct reg_table *t;
+	struct reg_entry *ent;
+	const struct devq_attr *attr;
+	char path[DEVQ_DEVNAME_MAX];
+	size_t dlen;
+
+	if ((type != DEVQ_ATTACHED && type != DEVQ_DETACHED) ||
+	    a->name_len == 0 || a->name_len + 5 >= sizeof(path))
+		return;
+
+	snprintf(path, sizeof(path), "/dev/%.*s", (int)a->name_len,
+	    line + a->name_off);
+
+	atomic_fetch_add_explicit(&reg->seq, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	if (type == DEVQ_DETACHED) {
+		t = atomic_load_explicit(&reg->table, memory_order_relaxed);
+		if ((ent = reg_slot(t, path, 0)) != NULL)
+			ent->state = REG_DELETED;
+		goto out;
+	}
+
+	if ((t = reg_grow(reg)) == NULL)
+		goto out;
+	ent = reg_slot(t, path, 1);
+	if (ent->state == REG_EMPTY)
+		t->used++;
+	ent->state = REG_USED;
+
+	memset(&ent->info, 0, sizeof(ent->info));
+	strlcpy(ent->info.path, path, sizeof(ent->info.path));
+	dlen = driver_len(line + a->name_off, a->name_len);
+	memcpy(ent->info.driver, line + a->name_off, dlen);
+	hw_type_lookup(line + a->name_off, a->name_len, &ent->info.type,
+	    &ent->info.class);
+	attr = attrs_find(a, line, "vendor", 6);
+	ent->info.vendor_id = attr != NULL ?
+	    (int)strtol(line + attr->val_off, NULL, 16) : -1;
+	attr = attrs_find(a, line, "product", 7);
+	ent->info.product_id = attr != NULL ?
+	    (int)strtol(line + attr->val_off, NULL, 16) : -1;
+
+out:
+	atomic_fetch_add_explicit(&reg->seq, 1, memory_order_release);
+}
+
+static void
+reg_free(struct devq_registry *reg)
+{
+	struct reg_table *t, *next;
+
+	if (reg == NULL)
+		return;
+
+	for (t = atomic_load(&reg->table); t != NULL; t = next) {
+		next = t->retired;
+		free(t);
+	}
+	free(reg);
+}
+
+/*
+ * Called for every line read, while it is still in the receive buffer:
+ * update the registry and the DRM topology cache, and tell whether the
+ * line is to be dropped. The attributes are kept in evm->scratch for
+ * event_new().
+ */
+static int
+event_prepare(struct devq_evmon *evm, const char *line, size_t len)
+{
+	struct devq_registry *reg;
+
+	if (_devq_drm_event(line, len))
+		_devq_drm_invalidate();
+
+	/* A registry left behind by clearing the flag is no longer kept */
+	reg = (evm->flags & DEVQ_EVMON_REGISTRY) ? evm->registry : NULL;
+
+	evm->scratch_valid = 0;
+	if (evm->filters == NULL && reg == NULL)
+		return (0);
+
+	attrs_parse(&evm->scratch, line, len);
+	evm->scratch_valid = 1;
+
+	if (reg != NULL)
+		reg_update(reg, line_type(line), line, &evm->scratch);
+
+	if (evm->filters == NULL ||
+	    filters_match(evm->filters, line, &evm->scratch))
+		return (0);
+
+	evm->stats.filtered++;
+
+	return (1);
+}
+
+/*
+ * Make sure str can hold len bytes plus a terminating NUL.
+ */
+static char *
+pool_reserve(struct devq_evmon *evm, struct devq_str *str, size_t len)
+{
+	char *buf;
+	size_t cap;
+
+	if (str->cap > len)
+		return (str->buf);
+
+	for (cap = str->cap ? str->cap : 32; cap <= len; cap *= 2)
+		;
+	if ((buf = realloc(str->buf, cap)) == NULL)
+		return (NULL);
+	str->buf = buf;
+	str->cap = cap;
+	if (evm != NULL)
+		evm->stats.allocs++;
+
+	return (buf);
+}
+
+static char *
+pool_strncpy(struct devq_evmon *evm, struct devq_str *str, const char *s,
+    size_t len)
+{
+
+	if (pool_reserve(evm, str, len) == NULL)
+		return (NULL);
+	memcpy(str->buf, s, len);
+	str->buf[len] = '\0';
+
+	return (str->buf);
+}
+
+static struct devq_event *
+pool_get(struct devq_evmon *evm)
+{
+	struct devq_event *e;
+
+	pthread_mutex_lock(&evm->pool_lock);
+	if ((e = evm->pool) != NULL) {
+		evm->pool = e->next;
+		evm->npool--;
+	}
+	evm->outstanding++;
+	pthread_mutex_unlock(&evm->pool_lock);
+
+	if (e == NULL) {
+		if ((e = calloc(1, sizeof(struct devq_event))) == NULL) {
+			pthread_mutex_lock(&evm->pool_lock);
+			evm->outstanding--;
+			pthread_mutex_unlock(&evm->pool_lock);
+			return (NULL);
+		}
+		e->evm = evm;
+		e->dev.event = e;
+		evm->stats.allocs++;
+	}
+
+	return (e);
+}
+
+static void
+event_destroy(struct devq_event *e)
+{
+
+	free(e->dev.pathbuf.buf);
+	free(e->attrbuf.buf);
+	free(e->dev.vendorbuf.buf);
+	free(e->dev.productbuf.buf);
+	free(e->rawbuf.buf);
+	free(e);
+}
+
+static void
+evmon_destroy(struct devq_evmon *evm)
+{
+	struct devq_event *e;
+
+	while ((e = evm->pool) != NULL) {
+		evm->pool = e->next;
+		event_destroy(e);
+	}
+	filters_free(evm->filters);
+	handlers_free(evm->handlers);
+	reg_free(evm->registry);
+	pthread_mutex_destroy(&evm->hub_lock);
+	pthread_mutex_destroy(&evm->res_lock);
+	pthread_cond_destroy(&evm->res_cond);
+	pthread_mutex_destroy(&evm->pool_lock);
+	free(evm);
+}
+
+struct devq_evmon *
+devq_event_monitor_init_fd(int fd)
+{
+	struct devq_evmon	*evm;
+
+	if ((evm = calloc(1, sizeof (struct devq_evmon))) == NULL)
+		return (NULL);
+
+	evm->fd = fd;
+	evm->len = DEVQ_RECVBUF_SIZE;
+	if ((evm->buf = malloc(evm->len)) == NULL) {
+		free(evm);
+		return (NULL);
+	}
+
+	evm->os = _devq_evmon_os_init(fd, &evm->recv_min);
+	if (evm->os == NULL) {
+		free(evm->buf);
+		free(evm);
+		return (NULL);
+	}
+
+	pthread_mutex_init(&evm->pool_lock, NULL);
+	pthread_mutex_init(&evm->hub_lock, NULL);
+	pthread_mutex_init(&evm->res_lock, NULL);
+	pthread_cond_init(&evm->res_cond, NULL);
+	evm->res_jobs_tail = &evm->res_jobs;
+	evm->res_done_tail = &evm->res_done;
+
+	return (evm);
+}
+
+struct devq_evmon *
+devq_event_monitor_init(void)
+{
+	struct devq_evmon	*evm;
+	int			 fd;
+
+	fd = _devq_evmon_os_connect();
+	if (fd < 0)
+		return (NULL);
+
+	if ((evm = devq_event_monitor_init_fd(fd)) == NULL)
+		close(fd);
+
+	return (evm);
+}
+
+void
+devq_event_monitor_fini(struct devq_evmon *evm)
+{
+	struct devq_evsub *sub;
+	int destroy;
+
+	if (evm == NULL)
+		return;
+
+	/*
+	 * Subscribers still attached see the end of the stream once they
+	 * have read what they were given, and keep the monitor alive until
+	 * they unsubscribe.
+	 */
+	if (evm->hub_running) {
+		atomic_store(&evm->hub_stop, 1);
+		_devq_evmon_os_wakeup(evm->os);
+		pthread_join(evm->hub_thread, NULL);
+
+		pthread_mutex_lock(&evm->hub_lock);
+		if (!atomic_load(&evm->hub_done)) {
+			evm->hub_error = 0;
+			atomic_store(&evm->hub_done, 1);
+			for (sub = evm->subs; sub != NULL; sub = sub->next)
+				_devq_evmon_os_wakeup(sub->os);
+		}
+		pthread_mutex_unlock(&evm->hub_lock);
+	}
+	if (evm->res_nthreads > 0)
+		resolver_stop(evm);
+
+	_devq_evmon_os_fini(evm->os);
+	close(evm->fd);
+	free(evm->buf);
+	evm->buf = NULL;
+
+	/* Events still held by the caller keep the pool alive */
+	pthread_mutex_lock(&evm->pool_lock);
+	evm->closing = 1;
+	destroy = (evm->outstanding == 0);
+	pthread_mutex_unlock(&evm->pool_lock);
+
+	if (destroy)
+		evmon_destroy(evm);
+}
+
+int
+devq_event_monitor_get_fd(struct devq_evmon *evm)
+{
+
+	if (evm == NULL)
+		return (-1);
+
+	/*
+	 * The caller reads until EAGAIN after each wakeup, which drains the
+	 * lines already buffered as well.
+	 */
+	if (evm->flags & DEVQ_EVMON_RAWFD)
+		return (evm->fd);
+
+	/*
+	 * The caller will wait on the descriptor itself, so lines already
+	 * sitting in the receive buffer must make it fire as well.
+	 */
+	if (!evm->fd_user) {
+		evm->fd_user = 1;
+		socket_notify(evm);
+	}
+
+	return (_devq_evmon_os_fd(evm->os));
+}
+
+int
+devq_event_monitor_add_filter(struct devq_evmon *evm, devq_event_t type,
+    devq_class_t class, const char *driver, const char *attrs)
+{
+	struct devq_filter *f;
+
+	if (evm == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	if ((f = filter_compile(type, class, driver, attrs)) == NULL)
+		return (-1);
+
+	/* The hub thread matches the filters with the lock held */
+	pthread_mutex_lock(&evm->hub_lock);
+	f->next = evm->filters;
+	evm->filters = f;
+	pthread_mutex_unlock(&evm->hub_lock);
+
+	return (0);
+}
+
+void
+devq_event_monitor_clear_filters(struct devq_evmon *evm)
+{
+	struct devq_filter *filters;
+
+	if (evm == NULL)
+		return;
+
+	pthread_mutex_lock(&evm->hub_lock);
+	filters = evm->filters;
+	evm->filters = NULL;
+	pthread_mutex_unlock(&evm->hub_lock);
+
+	filters_free(filters);
+}
+
+int
+devq_event_monitor_on(struct devq_evmon *evm, devq_event_t type,
+    devq_class_t class, devq_handler_t cb, void *ctx)
+{
+	struct devq_handler *h, **tail;
+
+	if (evm == NULL || cb == NULL || type > DEVQ_UNKNOWN) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	if ((h = calloc(1, sizeof(*h))) == NULL)
+		return (-1);
+
+	h->type = type;
+	h->class = class;
+	h->cb = cb;
+	h->ctx = ctx;
+
+	for (tail = &evm->handlers; *tail != NULL; tail = &(*tail)->next)
+		;
+	*tail = h;
+	evm->handled |= (type != 0 ? 1U << type : 1U);
+
+	return (0);
+}
+
+int
+devq_event_monitor_get_flags(struct devq_evmon *evm)
+{
+
+	if (evm == NULL)
+		return (0);
+
+	return (evm->flags);
+}
+
+int
+devq_event_monitor_set_flags(struct devq_evmon *evm, int flags)
+{
+	struct devq_registry *reg;
+
+	if (evm == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	/* The hub thread reads the flags and the registry with it held */
+	pthread_mutex_lock(&evm->hub_lock);
+
+	/* The resolver threads only report to the reader of the monitor */
+	if ((flags & DEVQ_EVMON_ASYNC_IDS) && evm->hub_running) {
+		errno = EBUSY;
+		goto fail;
+	}
+
+	/*
+	 * Once created, the registry stays until the monitor is freed
+	 * since other threads may be reading it.
+	 */
+	if ((flags & DEVQ_EVMON_REGISTRY) && evm->registry == NULL) {
+		if ((reg = calloc(1, sizeof(*reg))) == NULL)
+			goto fail;
+		atomic_init(&reg->seq, 0);
+		atomic_init(&reg->table, reg_table_new(REG_MIN_SLOTS));
+		if (atomic_load(&reg->table) == NULL) {
+			free(reg);
+			goto fail;
+		}
+		evm->registry = reg;
+	}
+
+	/* The resolver threads, too, stay until the monitor is freed */
+	if ((flags & DEVQ_EVMON_ASYNC_IDS) && evm->res_nthreads == 0 &&
+	    resolver_start(evm) != 0)
+		goto fail;
+
+	evm->flags = flags;
+	pthread_mutex_unlock(&evm->hub_lock);
+
+	return (0);
+
+fail:
+	pthread_mutex_unlock(&evm->hub_lock);
+	return (-1);
+}
+
+static void
+reg_begin(struct devq_registry *reg, unsigned int *seq)
+{
+
+	while ((*seq = atomic_load_explicit(&reg->seq,
+	    memory_order_acquire)) & 1)
+		sched_yield();
+}
+
+static int
+reg_retry(struct devq_registry *reg, unsigned int seq)
+{
+
+	atomic_thread_fence(memory_order_acquire);
+
+	return (atomic_load_explicit(&reg->seq, memory_order_relaxed) != seq);
+}
+
+int
+devq_event_monitor_find_device(struct devq_evmon *evm, const char *path,
+    struct devq_devinfo *info)
+{
+	struct devq_registry *reg;
+	struct reg_table *t;
+	struct reg_entry *ent;
+	unsigned int seq;
+	int found;
+
+	if (evm == NULL || (reg = evm->registry) == NULL || path == NULL ||
+	    info == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	do {
+		reg_begin(reg, &seq);
+		t = atomic_load_explicit(&reg->table, memory_order_acquire);
+		ent = reg_slot(t, path, 0);
+		if ((found = (ent != NULL)))
+			memcpy(info, &ent->info, sizeof(*info));
+	} while (reg_retry(reg, seq));
+
+	if (!found) {
+		errno = ENOENT;
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+devq_event_monitor_list_devices(struct devq_evmon *evm, devq_device_t type,
+    devq_class_t class, const char *driver, struct devq_devinfo *infos,
+    size_t max)
+{
+	struct devq_registry *reg;
+	struct reg_table *t;
+	struct reg_entry *ent;
+	struct devq_devinfo info;
+	unsigned int seq;
+	size_t i, n;
+
+	if (evm == NULL || (reg = evm->registry) == NULL ||
+	    (infos == NULL && max > 0)) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	do {
+		reg_begin(reg, &seq);
+		t = atomic_load_explicit(&reg->table, memory_order_acquire);
+		for (n = 0, i = 0; i <= t->mask; i++) {
+			ent = &t->slots[i];
+			if (ent->state != REG_USED)
+				continue;
+			memcpy(&info, &ent->info, sizeof(info));
+			if ((type != 0 && info.type != type) ||
+			    (class != 0 && info.class != class) ||
+			    (driver != NULL && strncmp(info.driver, driver,
+			    sizeof(info.driver)) != 0))
+				continue;
+			if (n < max)
+				infos[n] = info;
+			n++;
+		}
+	} while (reg_retry(reg, seq));
+
+	return ((int)n);
+}
+
+/*
+ * Once it has subscribers, the monitor is read by the hub thread only.
+ */
+static int
+evmon_busy(struct devq_evmon *evm)
+{
+
+	if (evm->hub_running) {
+		errno = EBUSY;
+		return (1);
+	}
+
+	return (0);
+}
+
+int
+devq_event_monitor_get_stats(struct devq_evmon *evm,
+    struct devq_evmon_stats *stats)
+{
+
+	if (evm == NULL || stats == NULL)
+		return (-1);
+
+	pthread_mutex_lock(&evm->hub_lock);
+	*stats = evm->stats;
+	pthread_mutex_unlock(&evm->hub_lock);
+
+	return (0);
+}
+
+int
+devq_event_monitor_poll(struct devq_evmon *evm)
+{
+
+	return (devq_event_monitor_poll_timeout(evm, -1) > 0);
+}
+
+int
+devq_event_monitor_poll_timeout(struct devq_evmon *evm, int timeout)
+{
+
+	if (evm == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (evmon_busy(evm))
+		return (-1);
+
+	if (!evm->fd_user && (socket_pending(evm) ||
+	    atomic_load(&evm->res_ndone) > 0))
+		return (1);
+
+	evm->stats.polls++;
+
+	return (_devq_evmon_os_wait(evm->os, timeout));
+}
+
+static struct devq_event *
+event_new(struct devq_evmon *evm, const char *line, size_t len)
+{
+	struct devq_event *e;
+
+	if ((e = pool_get(evm)) == NULL)
+		return (NULL);
+
+	atomic_store_explicit(&e->refs, 1, memory_order_relaxed);
+	e->raw = pool_strncpy(evm, &e->rawbuf, line, len);
+	if (e->raw == NULL) {
+		devq_event_free(e);
+		return (NULL);
+	}
+
+	/* The line may already have been tokenized by event_prepare() */
+	if (evm->scratch_valid)
+		e->attrs = evm->scratch;
+	else
+		attrs_parse(&e->attrs, e->raw, len);
+	evm->stats.events++;
+
+	e->type = line_type(e->raw);
+
+	if (evm->flags & DEVQ_EVMON_ASYNC_IDS)
+		resolver_submit(evm, e);
+
+	return (e);
+}
+
+struct devq_event *
+devq_event_monitor_read(struct devq_evmon *evm)
+{
+	char *line;
+	ssize_t sz;
+
+	if (evm == NULL) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	if (evmon_busy(evm))
+		return (NULL);
+
+	/*
+	 * With the raw socket in the caller's hands, never block either:
+	 * the caller has no way to tell that lines are already buffered.
+	 * A partial line stays in the receive buffer until the rest of it
+	 * arrives.
+	 */
+	do {
+		if ((sz = socket_getline(evm, &line, evm->flags &
+		    (DEVQ_EVMON_NONBLOCK | DEVQ_EVMON_RAWFD))) < 0)
+			return (NULL);
+	} while (event_prepare(evm, line, sz));
+
+	socket_notify(evm);
+
+	return (event_new(evm, line, sz));
+}
+
+int
+devq_event_monitor_read_batch(struct devq_evmon *evm,
+    struct devq_event **events, size_t max)
+{
+	struct devq_event *e;
+	char *line;
+	size_t n;
+	ssize_t sz;
+	int filled;
+
+	if (evm == NULL || events == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (evmon_busy(evm))
+		return (-1);
+
+	n = 0;
+	filled = 0;
+	while (n < max) {
+		if ((line = socket_batchline(evm, &filled, &sz)) == NULL) {
+			if (sz == 0 || n > 0)
+				break;
+			return (-1);
+		}
+
+		if (event_prepare(evm, line, sz))
+			continue;
+
+		if ((e = event_new(evm, line, sz)) == NULL) {
+			if (n == 0)
+				return (-1);
+			break;
+		}
+		events[n++] = e;
+	}
+
+	socket_notify(evm);
+
+	return ((int)n);
+}
+
+/*
+ * Call the handlers wanting the line, in the order they were registered,
+ * and return whether there were any. The line is classified from the
+ * receive buffer: no event is built unless a handler wants it.
+ */
+static int
+handlers_call(struct devq_evmon *evm, const char *line, size_t len)
+{
+	struct devq_handler *h;
+	struct devq_event *e;
+	devq_event_t type;
+	devq_device_t dtype;
+	devq_class_t class;
+
+	type = line_type(line);
+	if ((evm->handled & (1U | 1U << type)) == 0)
+		return (0);
+
+	if (!evm->scratch_valid) {
+		attrs_parse(&evm->scratch, line, len);
+		evm->scratch_valid = 1;
+	}
+
+	/* As with filters, only attach and detach events have a class */
+	class = 0;
+	if (evm->scratch.name_len > 0)
+		hw_type_lookup(line + evm->scratch.name_off,
+		    evm->scratch.name_len, &dtype, &class);
+
+	e = NULL;
+	for (h = evm->handlers; h != NULL; h = h->next) {
+		if ((h->type != 0 && h->type != type) ||
+		    (h->class != 0 && h->class != class))
+			continue;
+		if (e == NULL && (e = event_new(evm, line, len)) == NULL)
+			return (-1);
+		h->cb(e, h->ctx);
+	}
+
+	if (e == NULL)
+		return (0);
+
+	devq_event_free(e);
+
+	return (1);
+}
+
+int
+devq_event_monitor_dispatch(struct devq_evmon *evm, size_t max)
+{
+	char *line;
+	size_t n;
+	ssize_t sz;
+	int filled, ret;
+
+	if (evm == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (evmon_busy(evm))
+		return (-1);
+
+	n = 0;
+	filled = 0;
+	while (n < max) {
+		if ((line = socket_batchline(evm, &filled, &sz)) == NULL) {
+			if (sz == 0 || n > 0)
+				break;
+			return (-1);
+		}
+
+		if (event_prepare(evm, line, sz))
+			continue;
+
+		if ((ret = handlers_call(evm, line, sz)) < 0) {
+			if (n == 0)
+				return (-1);
+			break;
+		}
+		n += ret;
+	}
+
+	socket_notify(evm);
+
+	return ((int)n);
+}
+
+devq_event_t
+devq_event_get_type(struct devq_event *e)
+{
+
+	if (e == NULL)
+		return (DEVQ_UNKNOWN);
+
+	return (e->type);
+}
+
+/*
+ * Return the hash slot of key in db: either the slot holding it or the
+ * empty slot where it belongs.
+ */
+static struct ids_slot *
+ids_slot(struct ids_db *db, uint32_t key, int product)
+{
+	struct ids_slot *slot;
+	uint32_t h;
+
+	h = (key ^ (product ? 0x9e3779b9 : 0)) * 0x85ebca6b;
+	for (h ^= h >> 16;; h++) {
+		slot = &db->slots[h & db->mask];
+		if (slot->name == NULL ||
+		    (slot->key == key && slot->product == product))
+			return (slot);
+	}
+}
+
+static int
+ids_insert(struct ids_db *db, uint32_t key, int product, const char *name)
+{
+	struct ids_slot *old, *slot;
+	size_t i, oldsize;
+
+	if ((db->count + 1) * 2 > db->mask + 1) {
+		old = db->slots;
+		oldsize = old != NULL ? db->mask + 1 : 0;
+		db->slots = calloc(oldsize ? oldsize * 2 : IDS_MIN_SLOTS,
+		    sizeof(struct ids_slot));
+		if (db->slots == NULL) {
+			db->slots = old;
+			return (-1);
+		}
+		db->mask = (oldsize ? oldsize * 2 : IDS_MIN_SLOTS) - 1;
+		for (i = 0; i < oldsize; i++) {
+			if (old[i].name != NULL)
+				*ids_slot(db, old[i].key, old[i].product) =
+				    old[i];
+		}
+		free(old);
+	}
+
+	slot = ids_slot(db, key, product);
+	if (slot->name != NULL)
+		return (0);	/* keep the first entry, as a linear scan would */
+
+	slot->key = key;
+	slot->product = product;
+	slot->name = name;
+	db->count++;
+
+	return (0);
+}
+
+static int
+ids_hex4(const char *s, uint32_t *val)
+{
+	int i;
+
+	*val = 0;
+	for (i = 0; i < 4; i++) {
+		if (!isxdigit((unsigned char)s[i]))
+			return (-1);
+		*val = (*val << 4) |
+		    (isdigit((unsigned char)s[i]) ? s[i] - '0' :
+		    (tolower((unsigned char)s[i]) - 'a' + 10));
+	}
+
+	return (isspace((unsigned char)s[4]) ? 0 : -1);
+}
+
+static void
+ids_unload(struct ids_db *db)
+{
+
+	free(db->slots);
+	free(db->data);
+	db->slots = NULL;
+	db->data = NULL;
+	db->mask = 0;
+	db->count = 0;
+}
+
+/*
+ * Load a pci.ids/usb.ids style database in memory. The whole file is
+ * kept in one buffer and the names stored in the index point into it.
+ */
+static void
+ids_load(struct ids_db *db, int fd, const struct stat *st)
+{
+	char *line, *next, *walk, *end;
+	uint32_t vendor, id;
+	ssize_t ret;
+	size_t len;
+	int have_vendor;
+
+	ids_unload(db);
+
+	if ((db->data = malloc(st->st_size + 1)) == NULL)
+		return;
+
+	for (len = 0; len < (size_t)st->st_size; len += ret) {
+		ret = read(fd, db->data + len, st->st_size - len);
+		if (ret <= 0)
+			break;
+	}
+	db->data[len] = '\0';
+
+	have_vendor = 0;
+	vendor = 0;
+	for (line = db->data; *line != '\0'; line = next) {
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+
+		if (*line == '#' || *line == '\0')
+			continue;
+
+		if (line[0] == '\t' && line[1] == '\t')
+			continue;	/* subsystems are not used */
+
+		if (line[0] == '\t') {
+			if (!have_vendor || ids_hex4(line + 1, &id) != 0)
+				continue;
+			walk = line + 5;
+			id |= vendor << 16;
+		} else {
+			/* Other sections (classes, languages...) end this one */
+			have_vendor = (ids_hex4(line, &vendor) == 0);
+			if (!have_vendor)
+				continue;
+			walk = line + 4;
+			id = vendor;
+		}
+
+		while (isspace((unsigned char)*walk))
+			walk++;
+		end = walk + strlen(walk);
+		while (end > walk && isspace((unsigned char)end[-1]))
+			*--end = '\0';
+
+		if (ids_insert(db, id, line[0] == '\t', walk) != 0) {
+			ids_unload(db);
+			return;
+		}
+	}
+}
+
+static void
+ids_unmap(struct ids_db *db)
+{
+
+	if (db->map != NULL)
+		munmap(db->map, db->maplen);
+	db->map = NULL;
+	db->maplen = 0;
+	db->entries = NULL;
+	db->nentries = 0;
+	db->strings = NULL;
+}
+
+static int
+ids_cache_current(const struct ids_cache_hdr *hdr, const struct stat *st)
+{
+
+	return (st == NULL ||
+	    (hdr->src_mtime_sec == st->st_mtim.tv_sec &&
+	    hdr->src_mtime_nsec == st->st_mtim.tv_nsec &&
+	    hdr->src_size == st->st_size));
+}
+
+/*
+ * Map the precompiled cache of db if it exists, is well formed and was
+ * built from the text file described by st (NULL if there is none).
+ */
+static int
+ids_map(struct ids_db *db, const struct stat *st)
+{
+	const struct ids_cache_hdr *hdr;
+	struct stat cst;
+	void *map;
+	int fd;
+
+	if ((fd = open(db->cache_path, O_RDONLY | O_CLOEXEC)) < 0)
+		return (-1);
+
+	if (fstat(fd, &cst) != 0 ||
+	    (size_t)cst.st_size < sizeof(struct ids_cache_hdr)) {
+		close(fd);
+		return (-1);
+	}
+
+	map = mmap(NULL, cst.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return (-1);
+
+	hdr = map;
+	if (hdr->magic != IDS_CACHE_MAGIC ||
+	    hdr->version != IDS_CACHE_VERSION ||
+	    hdr->nentries > (cst.st_size - sizeof(*hdr)) /
+	    sizeof(struct ids_cache_entry) ||
+	    hdr->strsize == 0 ||
+	    sizeof(*hdr) + hdr->nentries * sizeof(struct ids_cache_entry) +
+	    hdr->strsize != (uint64_t)cst.st_size ||
+	    ((const char *)map)[cst.st_size - 1] != '\0' ||
+	    !ids_cache_current(hdr, st)) {
+		munmap(map, cst.st_size);
+		return (-1);
+	}
+
+	ids_unmap(db);
+	db->map = map;
+	db->maplen = cst.st_size;
+	db->entries = (const struct ids_cache_entry *)(hdr + 1);
+	db->nentries = hdr->nentries;
+	db->strings = (const char *)(db->entries + db->nentries);
+
+	return (0);
+}
+
+/*
+ * Make db usable: prefer the precompiled cache, fall back on indexing
+ * the text file if the cache is missing or stale, and reload the index
+ * if the text file changed since it was last read. The files are looked
+ * at no more than once per IDS_CHECK_INTERVAL seconds.
+ */
+static void
+ids_refresh(struct ids_db *db)
+{
+	struct stat st;
+	time_t now;
+	int fd, have_src;
+
+	now = time(NULL);
+	if (db->checked != 0 && now - db->checked < IDS_CHECK_INTERVAL)
+		return;
+	db->checked = now;
+
+	have_src = (stat(db->path, &st) == 0);
+
+	if (db->map != NULL &&
+	    ids_cache_current(db->map, have_src ? &st : NULL))
+		return;
+
+	if (ids_map(db, have_src ? &st : NULL) == 0) {
+		ids_unload(db);
+		return;
+	}
+	ids_unmap(db);
+
+	if (!have_src) {
+		ids_unload(db);
+		return;
+	}
+
+	if (db->data != NULL &&
+	    st.st_mtim.tv_sec == db->mtime.tv_sec &&
+	    st.st_mtim.tv_nsec == db->mtime.tv_nsec &&
+	    st.st_size == db->size)
+		return;
+
+	if ((fd = open(db->path, O_RDONLY | O_CLOEXEC)) < 0) {
+		ids_unload(db);
+		return;
+	}
+
+	if (fstat(fd, &st) == 0) {
+		ids_load(db, fd, &st);
+		db->mtime = st.st_mtim;
+		db->size = st.st_size;
+	}
+
+	close(fd);
+}
+
+static const char *
+ids_find(struct ids_db *db, uint32_t key, int product)
+{
+	const struct ids_cache_entry *ent;
+	uint64_t k, lo, hi, mid;
+
+	if (db->map == NULL)
+		return (db->slots != NULL ? ids_slot(db, key, product)->name :
+		    NULL);
+
+	k = ((uint64_t)product << 32) | key;
+	lo = 0;
+	hi = db->nentries;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		ent = &db->entries[mid];
+		if (ent->key == k)
+			return (ent->name < db->maplen -
+			    (size_t)(db->strings - (const char *)db->map) ?
+			    db->strings + ent->name : NULL);
+		if (ent->key < k)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (NULL);
+}
+
+static void
+vendor_product(struct devq_device *d, struct ids_db *db)
+{
+	struct devq_event *e = d->event;
+	struct devq_evmon *evm;
+	const char *name;
+	uint32_t vendor, product;
+
+	vendor = strtoul(e->raw + d->vendor_off, NULL, 16);
+	product = d->product_len != 0 ?
+	    strtoul(e->raw + d->product_off, NULL, 16) : 0;
+
+	ids_refresh(db);
+
+	/* Not counted for events resolved outside the reader */
+	evm = (e->shared || e->async) ? NULL : e->evm;
+
+	if ((name = ids_find(db, vendor, 0)) == NULL)
+		return;
+	d->vendor = pool_strncpy(evm, &d->vendorbuf, name, strlen(name));
+
+	if (d->vendor == NULL || d->product_len == 0)
+		return;
+
+	if ((name = ids_find(db, (vendor << 16) | product, 1)) != NULL)
+		d->product = pool_strncpy(evm, &d->productbuf, name,
+		    strlen(name));
+}
+
+static int
+ids_cache_cmp(const void *a, const void *b)
+{
+	const struct ids_cache_entry *ea = a, *eb = b;
+
+	return (ea->key < eb->key ? -1 : ea->key > eb->key);
+}
+
+int
+devq_ids_build_cache(const char *ids_path, const char *cache_path)
+{
+	struct ids_db db = { .path = ids_path };
+	struct ids_cache_hdr hdr;
+	struct ids_cache_entry *entries;
+	struct stat st;
+	char *tmp_path;
+	size_t i, n, len;
+	FILE *f;
+	int fd, ret, serrno;
+
+	if (ids_path == NULL || cache_path == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	if ((fd = open(ids_path, O_RDONLY | O_CLOEXEC)) < 0)
+		return (-1);
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return (-1);
+	}
+	ids_load(&db, fd, &st);
+	close(fd);
+	if (db.slots == NULL) {
+		errno = ENOENT;
+		return (-1);
+	}
+
+	entries = calloc(db.count, sizeof(*entries));
+	if (entries == NULL) {
+		ids_unload(&db);
+		return (-1);
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = IDS_CACHE_MAGIC;
+	hdr.version = IDS_CACHE_VERSION;
+	hdr.src_mtime_sec = st.st_mtim.tv_sec;
+	hdr.src_mtime_nsec = st.st_mtim.tv_nsec;
+	hdr.src_size = st.st_size;
+
+	for (i = 0, n = 0; i <= db.mask; i++) {
+		if (db.slots[i].name == NULL)
+			continue;
+		entries[n].key = ((uint64_t)db.slots[i].product << 32) |
+		    db.slots[i].key;
+		entries[n].name = hdr.strsize;
+		hdr.strsize += strlen(db.slots[i].name) + 1;
+		n++;
+	}
+	hdr.nentries = n;
+	qsort(entries, n, sizeof(*entries), ids_cache_cmp);
+
+	/* Write next to the destination and rename for atomic updates */
+	ret = -1;
+	f = NULL;
+	if (asprintf(&tmp_path, "%s.XXXXXX", cache_path) < 0) {
+		tmp_path = NULL;
+		goto out;
+	}
+	if ((fd = mkstemp(tmp_path)) < 0 || (f = fdopen(fd, "w")) == NULL) {
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp_path);
+		}
+		goto out;
+	}
+	fchmod(fd, 0644);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    (n > 0 && fwrite(entries, sizeof(*entries), n, f) != n))
+		goto fail;
+
+	/* Entries are sorted, write the names in their original order */
+	for (i = 0; i <= db.mask; i++) {
+		if (db.slots[i].name == NULL)
+			continue;
+		len = strlen(db.slots[i].name) + 1;
+		if (fwrite(db.slots[i].name, 1, len, f) != len)
+			goto fail;
+	}
+
+	if (fclose(f) != 0) {
+		f = NULL;
+		goto fail;
+	}
+	f = NULL;
+
+	if (rename(tmp_path, cache_path) != 0)
+		goto fail;
+
+	ret = 0;
+	goto out;
+
+fail:
+	serrno = errno;
+	if (f != NULL)
+		fclose(f);
+	unlink(tmp_path);
+	errno = serrno;
+out:
+	serrno = errno;
+	free(tmp_path);
+	free(entries);
+	ids_unload(&db);
+	errno = serrno;
+
+	return (ret);
+}
+
+/*
+ * The database naming the vendor and product of d, from its id_bus
+ * attribute (Linux), or NULL for no known one. Fails without it: as on
+ * FreeBSD, the driver name then tells USB devices, starting with 'u'.
+ */
+static int
+device_ids_bus(struct devq_device *d, struct ids_db **db)
+{
+	struct devq_event *e = d->event;
+	const struct devq_attr *attr;
+	const char *bus;
+
+	attr = attrs_find(&e->attrs, e->raw, "id_bus", 6);
+	if (attr == NULL)
+		return (-1);
+
+	bus = e->raw + attr->val_off;
+	if (attr->val_len == 3 && memcmp(bus, "usb", 3) == 0)
+		*db = &usbids;
+	else if (attr->val_len == 3 && memcmp(bus, "pci", 3) == 0)
+		*db = &pciids;
+	else
+		*db = NULL;
+
+	return (0);
+}
+
+static void
+device_resolve(struct devq_device *d)
+{
+	struct ids_db *db;
+
+	if (atomic_load_explicit(&d->resolved, memory_order_acquire))
+		return;
+
+	/* The subscribers of a shared event may get here at once */
+	if (d->vendor_len != 0) {
+		pthread_mutex_lock(&ids_lock);
+		if (!atomic_load_explicit(&d->resolved, memory_order_relaxed)) {
+			if (device_ids_bus(d, &db) == 0) {
+				if (db != NULL)
+					vendor_product(d, db);
+			} else {
+				if (d->event->raw[d->name_off] == 'u')
+					vendor_product(d, &usbids);
+				if (d->vendor == NULL)
+					vendor_product(d, &pciids);
+			}
+		}
+		pthread_mutex_unlock(&ids_lock);
+	}
+
+	atomic_store_explicit(&d->resolved, 1, memory_order_release);
+}
+
+static int
+device_vendor_product(struct devq_device *d)
+{
+
+	/* Left to the resolver threads, which tell when they are done */
+	if (d->event->async &&
+	    !atomic_load_explicit(&d->resolved, memory_order_acquire)) {
+		errno = EINPROGRESS;
+		return (-1);
+	}
+
+	device_resolve(d);
+
+	return (0);
+}
+
+static void
+device_attr(struct devq_event *e, const char *key, size_t *off, size_t *len)
+{
+	const struct devq_attr *attr;
+
+	attr = attrs_find(&e->attrs, e->raw, key, strlen(key));
+	*off = attr != NULL ? attr->val_off : 0;
+	*len = attr != NULL ? attr->val_len : 0;
+}
+
+struct devq_device *
+devq_event_get_device(struct devq_event *e)
+{
+	struct devq_device *d;
+
+	if (e == NULL)
+		return (NULL);
+
+	if (e->type != DEVQ_ATTACHED && e->type != DEVQ_DETACHED)
+		return (NULL);
+
+	if (e->device != NULL)
+		return (e->device);
+
+	d = &e->dev;
+	d->name_off = e->attrs.name_off;
+	d->name_len = e->attrs.name_len;
+	d->driver_len = driver_len(e->raw + d->name_off, d->name_len);
+	hw_type_lookup(e->raw + d->name_off, d->name_len, &d->type, &d->class);
+
+	device_attr(e, "vendor", &d->vendor_off, &d->vendor_len);
+	device_attr(e, "product", &d->product_off, &d->product_len);
+
+	e->device = d;
+
+	return (e->device);
+}
+
+const char *
+devq_event_dump(struct devq_event *e)
+{
+	return (e->raw);
+}
+
+/*
+ * Build a copy of the raw line where every key and value is a C string,
+ * the first time attributes are asked for.
+ */
+static const char *
+event_attrstr(struct devq_event *e)
+{
+	const struct devq_attr *attr;
+	size_t len;
+	unsigned int i;
+
+	if (e->attrstr != NULL)
+		return (e->attrstr);
+
+	len = strlen(e->raw);
+	if (pool_strncpy(e->evm, &e->attrbuf, e->raw, len) == NULL)
+		return (NULL);
+
+	for (i = 0; i < e->attrs.n; i++) {
+		attr = &e->attrs.attr[i];
+		e->attrbuf.buf[attr->key_off + attr->key_len] = '\0';
+		e->attrbuf.buf[attr->val_off + attr->val_len] = '\0';
+	}
+	e->attrstr = e->attrbuf.buf;
+
+	return (e->attrstr);
+}
+
+const char *
+devq_event_get_attr(struct devq_event *e, const char *key)
+{
+	const struct devq_attr *attr;
+	const char *str;
+
+	if (e == NULL || key == NULL)
+		return (NULL);
+
+	attr = attrs_find(&e->attrs, e->raw, key, strlen(key));
+	if (attr == NULL || (str = event_attrstr(e)) == NULL)
+		return (NULL);
+
+	return (str + attr->val_off);
+}
+
+int
+devq_event_attr_next(struct devq_event *e, unsigned int *iter,
+    const char **key, const char **value)
+{
+	const struct devq_attr *attr;
+	const char *str;
+
+	if (e == NULL || iter == NULL || *iter >= e->attrs.n ||
+	    (str = event_attrstr(e)) == NULL)
+		return (0);
+
+	attr = &e->attrs.attr[(*iter)++];
+	*key = str + attr->key_off;
+	*value = str + attr->val_off;
+
+	return (1);
+}
+
+void
+devq_event_free(struct devq_event *e)
+{
+	struct devq_evmon *evm;
+	int destroy;
+
+	if (e == NULL)
+		return;
+
+	/* A sole owner cannot race with anyone taking a reference */
+	if (atomic_load_explicit(&e->refs, memory_order_acquire) != 1 &&
+	    atomic_fetch_sub_explicit(&e->refs, 1, memory_order_acq_rel) != 1)
+		return;
+
+	evm = e->evm;
+	e->shared = 0;
+	e->async = 0;
+	e->device = NULL;
+	e->raw = NULL;
+	e->attrstr = NULL;
+	e->dev.path = e->dev.vendor = e->dev.product = NULL;
+	atomic_store_explicit(&e->dev.resolved, 0, memory_order_relaxed);
+
+	pthread_mutex_lock(&evm->pool_lock);
+	if (evm->npool < DEVQ_POOL_MAX && !evm->closing) {
+		e->next = evm->pool;
+		evm->pool = e;
+		evm->npool++;
+		e = NULL;
+	}
+	destroy = (--evm->outstanding == 0 && evm->closing);
+	pthread_mutex_unlock(&evm->pool_lock);
+
+	if (e != NULL)
+		event_destroy(e);
+	if (destroy)
+		evmon_destroy(evm);
+}
+
+devq_device_t
+devq_device_get_type(struct devq_device *d)
+{
+
+	if (d == NULL)
+		return (DEVQ_DEVICE_UNKNOWN);
+
+	return (d->type);
+}
+
+devq_class_t
+devq_device_get_class(struct devq_device *d)
+{
+
+	if (d == NULL)
+		return (DEVQ_CLASS_UNKNOWN);
+
+	return (d->class);
+}
+
+const char *
+devq_device_get_path(struct devq_device *d)
+{
+
+	if (d == NULL)
+		return (NULL);
+
+	if (d->path == NULL &&
+	    pool_reserve(d->event->evm, &d->pathbuf, d->name_len + 5) != NULL) {
+		snprintf(d->pathbuf.buf, d->pathbuf.cap, "/dev/%.*s",
+		    (int)d->name_len, d->event->raw + d->name_off);
+		d->path = d->pathbuf.buf;
+	}
+
+	return (d->path);
+}
+
+const char *
+devq_device_get_product(struct devq_device *d)
+{
+
+	if (d == NULL || device_vendor_product(d) != 0)
+		return (NULL);
+
+	return (d->product);
+}
+
+const char *
+devq_device_get_vendor(struct devq_device *d)
+{
+
+	if (d == NULL || device_vendor_product(d) != 0)
+		return (NULL);
+
+	return (d->vendor);
+}
+
+const char *
+devq_device_get_name(struct devq_device *d, size_t *len)
+{
+
+	if (d == NULL)
+		return (NULL);
+
+	*len = d->name_len;
+
+	return (d->event->raw + d->name_off);
+}
+
+const char *
+devq_device_get_driver(struct devq_device *d, size_t *len)
+{
+
+	if (d == NULL)
+		return (NULL);
+
+	*len = d->driver_len;
+
+	return (d->event->raw + d->name_off);
+}
+
+const char *
+devq_device_get_vendor_id(struct devq_device *d, size_t *len)
+{
+
+	if (d == NULL || d->vendor_len == 0)
+		return (NULL);
+
+	*len = d->vendor_len;
+
+	return (d->event->raw + d->vendor_off);
+}
+
+const char *
+devq_device_get_product_id(struct devq_device *d, size_t *len)
+{
+
+	if (d == NULL || d->product_len == 0)
+		return (NULL);
+
+	*len = d->product_len;
+
+	return (d->event->raw + d->product_off);
+}
+
+/*
+ * Build an event for the subscribers of a shared monitor. Everything but
+ * the vendor and product names is built here, once, so that subscribers
+ * only ever read it.
+ */
+static struct devq_event *
+hub_event(struct devq_evmon *evm, const char *line, size_t len)
+{
+	struct devq_event *e;
+	struct devq_device *d;
+
+	if ((e = event_new(evm, line, len)) == NULL)
+		return (NULL);
+
+	if (((d = devq_event_get_device(e)) != NULL &&
+	    devq_device_get_path(d) == NULL) || event_attrstr(e) == NULL) {
+		devq_event_free(e);
+		return (NULL);
+	}
+	e->shared = 1;
+
+	return (e);
+}
+
+static void
+hub_publish(struct devq_evmon *evm, const char *line, size_t len)
+{
+	struct devq_evsub *sub;
+	struct devq_event *e;
+	size_t tail;
+
+	if (!evm->scratch_valid) {
+		attrs_parse(&evm->scratch, line, len);
+		evm->scratch_valid = 1;
+	}
+
+	e = NULL;
+	for (sub = evm->subs; sub != NULL; sub = sub->next) {
+		if (sub->filters != NULL &&
+		    !filters_match(sub->filters, line, &evm->scratch)) {
+			sub->stats.filtered++;
+			continue;
+		}
+
+		/* A subscriber too slow to keep up loses events */
+		tail = atomic_load_explicit(&sub->tail, memory_order_relaxed);
+		if (tail - atomic_load(&sub->head) > sub->mask ||
+		    (e == NULL && (e = hub_event(evm, line, len)) == NULL)) {
+			sub->stats.dropped++;
+			continue;
+		}
+
+		atomic_fetch_add_explicit(&e->refs, 1, memory_order_relaxed);
+		sub->ring[tail & sub->mask] = e;
+		atomic_store(&sub->tail, tail + 1);
+		sub->stats.events++;
+
+		/*
+		 * Only wake a subscriber that may have found its ring empty:
+		 * one that has not consumed everything yet will see the event
+		 * before it waits again.
+		 */
+		if (atomic_load(&sub->head) == tail)
+			_devq_evmon_os_wakeup(sub->os);
+	}
+
+	if (e != NULL)
+		devq_event_free(e);
+}
+
+/*
+ * Read what the socket holds and publish it. Returns 1 if more may be
+ * waiting, 0 if the socket is drained, or -1 at the end of the stream or
+ * on error.
+ */
+static int
+hub_pump(struct devq_evmon *evm)
+{
+	char *line;
+	ssize_t ret, len;
+	int error;
+
+	ret = socket_fill(evm, 1);
+	error = errno;
+
+	while ((line = socket_nextline(evm, &len)) != NULL) {
+		if (!event_prepare(evm, line, len))
+			hub_publish(evm, line, len);
+	}
+
+	if (ret > 0)
+		return (1);
+	if (ret < 0 && error == EAGAIN)
+		return (0);
+
+	errno = ret == 0 ? 0 : error;
+
+	return (-1);
+}
+
+static void *
+hub_main(void *arg)
+{
+	struct devq_evmon *evm = arg;
+	struct devq_evsub *sub;
+	int ret;
+
+	ret = 0;
+	while (!atomic_load(&evm->hub_stop)) {
+		if (ret == 0 && _devq_evmon_os_wait(evm->os, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -1;
+			break;
+		}
+		pthread_mutex_lock(&evm->hub_lock);
+		if (ret == 0)
+			evm->stats.polls++;
+		ret = hub_pump(evm);
+		pthread_mutex_unlock(&evm->hub_lock);
+		if (ret < 0)
+			break;
+	}
+
+	if (ret < 0) {
+		pthread_mutex_lock(&evm->hub_lock);
+		evm->hub_error = errno;
+		atomic_store(&evm->hub_done, 1);
+		for (sub = evm->subs; sub != NULL; sub = sub->next)
+			_devq_evmon_os_wakeup(sub->os);
+		pthread_mutex_unlock(&evm->hub_lock);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Start a thread of the library. Signals are left to the threads of the
+ * application.
+ */
+static int
+thread_create(pthread_t *thread, void *(*start)(void *), void *arg)
+{
+	sigset_t all, saved;
+	int error;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+	error = pthread_create(thread, NULL, start, arg);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+	return (error);
+}
+
+/* Called with the hub lock held */
+static int
+hub_start(struct devq_evmon *evm)
+{
+	int error;
+
+	if ((error = thread_create(&evm->hub_thread, hub_main, evm)) != 0) {
+		errno = error;
+		return (-1);
+	}
+	evm->hub_running = 1;
+
+	return (0);
+}
+
+struct devq_evsub *
+devq_event_monitor_subscribe(struct devq_evmon *evm, size_t depth)
+{
+	struct devq_evsub *sub, **tail;
+	size_t size, recv_min;
+
+	if (evm == NULL || depth == 0) {
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	for (size = 1; size < depth; size *= 2)
+		;
+
+	sub = calloc(1, sizeof(*sub) + size * sizeof(sub->ring[0]));
+	if (sub == NULL)
+		return (NULL);
+	sub->evm = evm;
+	sub->mask = size - 1;
+	atomic_init(&sub->head, 0);
+	atomic_init(&sub->tail, 0);
+
+	if ((sub->os = _devq_evmon_os_init(-1, &recv_min)) == NULL) {
+		free(sub);
+		return (NULL);
+	}
+
+	pthread_mutex_lock(&evm->hub_lock);
+	/* The resolver threads only report to the reader of the monitor */
+	if (evm->flags & DEVQ_EVMON_ASYNC_IDS) {
+		errno = EBUSY;
+		goto fail;
+	}
+	if (!evm->hub_running && hub_start(evm) != 0)
+		goto fail;
+	for (tail = &evm->subs; *tail != NULL; tail = &(*tail)->next)
+		;
+	*tail = sub;
+	pthread_mutex_unlock(&evm->hub_lock);
+
+	/* Like an event, a subscriber keeps the monitor from being freed */
+	pthread_mutex_lock(&evm->pool_lock);
+	evm->outstanding++;
+	pthread_mutex_unlock(&evm->pool_lock);
+
+	return (sub);
+
+fail:
+	pthread_mutex_unlock(&evm->hub_lock);
+	_devq_evmon_os_fini(sub->os);
+	free(sub);
+	return (NULL);
+}
+
+void
+devq_event_unsubscribe(struct devq_evsub *sub)
+{
+	struct devq_evmon *evm;
+	struct devq_evsub **prev;
+	size_t head, tail;
+	int destroy;
+
+	if (sub == NULL)
+		return;
+
+	evm = sub->evm;
+	pthread_mutex_lock(&evm->hub_lock);
+	for (prev = &evm->subs; *prev != sub; prev = &(*prev)->next)
+		;
+	*prev = sub->next;
+	pthread_mutex_unlock(&evm->hub_lock);
+
+	head = atomic_load(&sub->head);
+	tail = atomic_load(&sub->tail);
+	for (; head != tail; head++)
+		devq_event_free(sub->ring[head & sub->mask]);
+
+	_devq_evmon_os_fini(sub->os);
+	filters_free(sub->filters);
+	free(sub);
+
+	pthread_mutex_lock(&evm->pool_lock);
+	destroy = (--evm->outstanding == 0 && evm->closing);
+	pthread_mutex_unlock(&evm->pool_lock);
+
+	if (destroy)
+		evmon_destroy(evm);
+}
+
+int
+devq_event_subscriber_get_fd(struct devq_evsub *sub)
+{
+
+	if (sub == NULL)
+		return (-1);
+
+	return (_devq_evmon_os_fd(sub->os));
+}
+
+int
+devq_event_subscriber_add_filter(struct devq_evsub *sub, devq_event_t type,
+    devq_class_t class, const char *driver, const char *attrs)
+{
+	struct devq_filter *f;
+
+	if (sub == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	if ((f = filter_compile(type, class, driver, attrs)) == NULL)
+		return (-1);
+
+	pthread_mutex_lock(&sub->evm->hub_lock);
+	f->next = sub->filters;
+	sub->filters = f;
+	pthread_mutex_unlock(&sub->evm->hub_lock);
+
+	return (0);
+}
+
+int
+devq_event_subscriber_poll(struct devq_evsub *sub, int timeout)
+{
+
+	if (sub == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	if (atomic_load(&sub->evm->hub_done) ||
+	    atomic_load(&sub->head) != atomic_load(&sub->tail))
+		return (1);
+
+	sub->stats.polls++;
+
+	return (_devq_evmon_os_wait(sub->os, timeout));
+}
+
+struct devq_event *
+devq_event_subscriber_read(struct devq_evsub *sub)
+{
+	struct devq_event *e;
+	size_t head;
+	int done;
+
+	if (sub == NULL) {
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	/* Everything published before the end is seen after it */
+	done = atomic_load(&sub->evm->hub_done);
+	head = atomic_load_explicit(&sub->head, memory_order_relaxed);
+	if (head == atomic_load(&sub->tail)) {
+		errno = done ? sub->evm->hub_error : EAGAIN;
+		return (NULL);
+	}
+
+	e = sub->ring[head & sub->mask];
+	atomic_store(&sub->head, head + 1);
+
+	return (e);
+}
+
+int
+devq_event_subscriber_get_stats(struct devq_evsub *sub,
+    struct devq_evmon_stats *stats)
+{
+
+	if (sub == NULL || stats == NULL)
+		return (-1);
+
+	pthread_mutex_lock(&sub->evm->hub_lock);
+	*stats = sub->stats;
+	pthread_mutex_unlock(&sub->evm->hub_lock);
+
+	return (0);
+}
+
+static void *
+resolver_main(void *arg)
+{
+	struct devq_evmon *evm = arg;
+	struct devq_event *e;
+	devq_handler_t cb;
+	void *ctx;
+
+	pthread_mutex_lock(&evm->res_lock);
+	for (;;) {
+		while (!evm->res_stop && evm->res_jobs == NULL)
+			pthread_cond_wait(&evm->res_cond, &evm->res_lock);
+		if (evm->res_stop)
+			break;
+
+		e = evm->res_jobs;
+		if ((evm->res_jobs = e->rnext) == NULL)
+			evm->res_jobs_tail = &evm->res_jobs;
+		cb = evm->res_cb;
+		ctx = evm->res_ctx;
+		pthread_mutex_unlock(&evm->res_lock);
+
+		device_resolve(&e->dev);
+		if (cb != NULL) {
+			cb(e, ctx);
+			devq_event_free(e);
+			pthread_mutex_lock(&evm->res_lock);
+			continue;
+		}
+
+		pthread_mutex_lock(&evm->res_lock);
+		e->rnext = NULL;
+		*evm->res_done_tail = e;
+		evm->res_done_tail = &e->rnext;
+		if (atomic_fetch_add(&evm->res_ndone, 1) == 0)
+			_devq_evmon_os_wakeup(evm->os);
+	}
+	pthread_mutex_unlock(&evm->res_lock);
+
+	return (NULL);
+}
+
+static int
+resolver_start(struct devq_evmon *evm)
+{
+	int error, i;
+
+	for (error = 0, i = 0; i < DEVQ_RESOLVERS; i++) {
+		error = thread_create(&evm->res_threads[i], resolver_main, evm);
+		if (error != 0)
+			break;
+		evm->res_nthreads++;
+	}
+
+	if (evm->res_nthreads == 0) {
+		errno = error;
+		return (-1);
+	}
+
+	return (0);
+}
+
+static void
+resolver_stop(struct devq_evmon *evm)
+{
+	struct devq_event *e;
+	int i;
+
+	pthread_mutex_lock(&evm->res_lock);
+	evm->res_stop = 1;
+	pthread_cond_broadcast(&evm->res_cond);
+	pthread_mutex_unlock(&evm->res_lock);
+
+	for (i = 0; i < evm->res_nthreads; i++)
+		pthread_join(evm->res_threads[i], NULL);
+
+	while ((e = evm->res_jobs) != NULL) {
+		evm->res_jobs = e->rnext;
+		devq_event_free(e);
+	}
+	while ((e = evm->res_done) != NULL) {
+		evm->res_done = e->rnext;
+		devq_event_free(e);
+	}
+}
+
+/*
+ * Queue an event for its vendor and product names to be looked up. It
+ * is handed out with everything else built, so that the resolver
+ * threads and the caller never write the same fields.
+ */
+static void
+resolver_submit(struct devq_evmon *evm, struct devq_event *e)
+{
+	struct devq_device *d;
+
+	if ((d = devq_event_get_device(e)) == NULL || d->vendor_len == 0 ||
+	    devq_device_get_path(d) == NULL)
+		return;
+
+	e->async = 1;
+	atomic_fetch_add_explicit(&e->refs, 1, memory_order_relaxed);
+
+	pthread_mutex_lock(&evm->res_lock);
+	e->rnext = NULL;
+	*evm->res_jobs_tail = e;
+	evm->res_jobs_tail = &e->rnext;
+	pthread_cond_signal(&evm->res_cond);
+	pthread_mutex_unlock(&evm->res_lock);
+}
+
+int
+devq_event_monitor_on_resolved(struct devq_evmon *evm, devq_handler_t cb,
+    void *ctx)
+{
+
+	if (evm == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	pthread_mutex_lock(&evm->res_lock);
+	evm->res_cb = cb;
+	evm->res_ctx = ctx;
+	pthread_mutex_unlock(&evm->res_lock);
+
+	return (0);
+}
+
+struct devq_event *
+devq_event_monitor_read_resolved(struct devq_evmon *evm)
+{
+	struct devq_event *e;
+
+	if (evm == NULL) {
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	if (atomic_load(&evm->res_ndone) == 0) {
+		errno = EAGAIN;
+		return (NULL);
+	}
+
+	pthread_mutex_lock(&evm->res_lock);
+	if ((e = evm->res_done) != NULL) {
+		if ((evm->res_done = e->rnext) == NULL)
+			evm->res_done_tail = &evm->res_done;
+		atomic_fetch_sub(&evm->res_ndone, 1);
+	}
+	pthread_mutex_unlock(&evm->res_lock);
+
+	if (e == NULL)
+		errno = EAGAIN;
+
+	return (e);
+}
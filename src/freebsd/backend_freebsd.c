@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2014 Jean-Sebastien Pedron <dumbbell@FreeBSD.org>
+ * Copyright (c) 2016 Koop Mast <kwm@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/pciio.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(HAVE_LIBPROCSTAT_H)
+# include <sys/param.h>
+# include <sys/queue.h>
+# include <sys/socket.h>
+# include <kvm.h>
+# include <libprocstat.h>
+#else
+# include <dirent.h>
+# include <fcntl.h>
+# include <pthread.h>
+# include <stdio.h>
+#endif
+
+#include "devq_private.h"
+
+/*
+ * The system calls behind the device query functions. They go through
+ * _devq_backend so that the queries can be run against something else
+ * than the running kernel, see tools/devq_drmbench.
+ */
+
+#if defined(HAVE_LIBPROCSTAT_H)
+struct fd_index {
+	int	fd;
+	size_t	i;
+};
+
+static int
+fd_index_cmp(const void *a, const void *b)
+{
+	const struct fd_index *x = a, *y = b;
+
+	return ((x->fd > y->fd) - (x->fd < y->fd));
+}
+
+/*
+ * The file table of the process is fetched once for all the
+ * descriptors, and each file of it is looked up among them.
+ */
+static int
+freebsd_fd_paths(const int *fds, size_t nfds,
+    void (*found)(void *arg, size_t i, const char *path), void *arg)
+{
+	int ret;
+	struct procstat *procstat;
+	struct kinfo_proc *kip;
+	struct filestat_list *head;
+	struct filestat *fst;
+	struct fd_index *index, *idx, key;
+	unsigned int count;
+	size_t i;
+
+	index = calloc(nfds > 0 ? nfds : 1, sizeof(*index));
+	if (index == NULL)
+		return (-1);
+	for (i = 0; i < nfds; i++) {
+		index[i].fd = fds[i];
+		index[i].i = i;
+	}
+	qsort(index, nfds, sizeof(*index), fd_index_cmp);
+
+	ret = -1;
+	kip = NULL;
+	head = NULL;
+
+	procstat = procstat_open_sysctl();
+	if (procstat == NULL)
+		goto out;
+
+	count = 0;
+	kip = procstat_getprocs(procstat, KERN_PROC_PID, getpid(), &count);
+	if (kip == NULL || count != 1)
+		goto out;
+
+	head = procstat_getfiles(procstat, kip, 0);
+	if (head == NULL)
+		goto out;
+
+	STAILQ_FOREACH(fst, head, next) {
+		if (fst->fs_uflags != 0 ||
+		    fst->fs_type != PS_FST_TYPE_VNODE ||
+		    fst->fs_path == NULL)
+			continue;
+
+		key.fd = fst->fs_fd;
+		idx = bsearch(&key, index, nfds, sizeof(*index),
+		    fd_index_cmp);
+		if (idx == NULL)
+			continue;
+
+		/* The same descriptor may be asked for more than once */
+		while (idx > index && idx[-1].fd == key.fd)
+			idx--;
+		for (; idx < index + nfds && idx->fd == key.fd; idx++)
+			found(arg, idx->i, fst->fs_path);
+	}
+	ret = 0;
+
+out:
+	if (head != NULL)
+		procstat_freefiles(procstat, head);
+	if (kip != NULL)
+		procstat_freeprocs(procstat, kip);
+	if (procstat != NULL)
+		procstat_close(procstat);
+	free(index);
+
+	return (ret);
+}
+
+struct fd_path_arg {
+	char	*path;
+	size_t	path_size;
+	int	error;
+};
+
+static void
+fd_path_found(void *arg, size_t i, const char *path)
+{
+	struct fd_path_arg *fpa = arg;
+
+	(void)i;
+	if (strlcpy(fpa->path, path, fpa->path_size) >= fpa->path_size)
+		fpa->error = ENAMETOOLONG;
+	else
+		fpa->error = 0;
+}
+
+static int
+freebsd_fd_path(int fd, char *path, size_t path_size)
+{
+	struct fd_path_arg fpa;
+
+	fpa.path = path;
+	fpa.path_size = path_size;
+	fpa.error = EBADF;
+
+	if (freebsd_fd_paths(&fd, 1, fd_path_found, &fpa) != 0)
+		return (-1);
+
+	if (fpa.error != 0) {
+		errno = fpa.error;
+		return (-1);
+	}
+
+	return (0);
+}
+#else /* !defined(HAVE_LIBPROCSTAT_H) */
+/*
+ * Index of the device nodes under /dev/dri by st_rdev, so that a lookup
+ * is a stat of the descriptor and of the directory rather than a stat
+ * of every node. The directory is read again, through a descriptor kept
+ * open, when its mtime changes, when a DRM event was seen or when a
+ * device is not found.
+ *
+ * FIXME: This is specific to DRM devices.
+ */
+#define	DEVQ_DRIDEV_DIR		"/dev/dri"
+#define	DEVDIR_BUCKETS		64
+
+struct devdir_entry {
+	dev_t	rdev;
+	int	next;			/* next entry in the bucket, or -1 */
+	char	name[NAME_MAX + 1];
+};
+
+struct devdir {
+	pthread_mutex_t		lock;
+	int			fd;
+	int			valid;
+	struct timespec		mtime;	/* of the directory when read */
+	unsigned int		gen;	/* _devq_drm_generation() then */
+	struct devdir_entry	*entries;
+	int			nentries;
+	int			size;
+	int			buckets[DEVDIR_BUCKETS];
+};
+
+static struct devdir devdir = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.fd = -1,
+};
+
+static int
+devdir_read(struct devdir *dd, const struct stat *dir_st)
+{
+	int fd, i;
+	DIR *dir;
+	struct dirent *dp;
+	struct devdir_entry *e;
+	struct stat st;
+
+	dd->valid = 0;
+	dd->nentries = 0;
+	for (i = 0; i < DEVDIR_BUCKETS; i++)
+		dd->buckets[i] = -1;
+
+	fd = openat(dd->fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return (-1);
+	dir = fdopendir(fd);
+	if (dir == NULL) {
+		close(fd);
+		return (-1);
+	}
+
+	while ((dp = readdir(dir)) != NULL) {
+		if (dp->d_name[0] == '.')
+			continue;
+		if (fstatat(dd->fd, dp->d_name, &st, 0) != 0 ||
+		    !S_ISCHR(st.st_mode))
+			continue;
+
+		if (dd->nentries == dd->size) {
+			e = reallocarray(dd->entries, dd->size + 16,
+			    sizeof(*e));
+			if (e == NULL) {
+				closedir(dir);
+				return (-1);
+			}
+			dd->entries = e;
+			dd->size += 16;
+		}
+
+		e = &dd->entries[dd->nentries];
+		e->rdev = st.st_rdev;
+		strlcpy(e->name, dp->d_name, sizeof(e->name));
+		i = st.st_rdev % DEVDIR_BUCKETS;
+		e->next = dd->buckets[i];
+		dd->buckets[i] = dd->nentries++;
+	}
+
+	closedir(dir);
+
+	dd->mtime = dir_st->st_mtim;
+	dd->valid = 1;
+
+	return (0);
+}
+
+static const struct devdir_entry *
+devdir_find(struct devdir *dd, dev_t rdev)
+{
+	int i;
+
+	for (i = dd->buckets[rdev % DEVDIR_BUCKETS]; i >= 0;
+	    i = dd->entries[i].next) {
+		if (dd->entries[i].rdev == rdev)
+			return (&dd->entries[i]);
+	}
+
+	return (NULL);
+}
+
+static int
+freebsd_fd_path(int fd, char *path, size_t path_size)
+{
+	struct devdir *dd;
+	const struct devdir_entry *e;
+	struct stat st, dir_st;
+	unsigned int gen;
+	int ret;
+
+	if (fstat(fd, &st) != 0)
+		return (-1);
+	if (!S_ISCHR(st.st_mode)) {
+		errno = EBADF;
+		return (-1);
+	}
+
+	dd = &devdir;
+	pthread_mutex_lock(&dd->lock);
+
+	ret = -1;
+	if (dd->fd < 0)
+		dd->fd = open(DEVQ_DRIDEV_DIR,
+		    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dd->fd < 0 || fstat(dd->fd, &dir_st) != 0)
+		goto out;
+
+	e = NULL;
+	gen = _devq_drm_generation();
+	if (dd->valid && dd->gen == gen &&
+	    dd->mtime.tv_sec == dir_st.st_mtim.tv_sec &&
+	    dd->mtime.tv_nsec == dir_st.st_mtim.tv_nsec)
+		e = devdir_find(dd, st.st_rdev);
+	if (e == NULL) {
+		dd->gen = gen;
+		if (devdir_read(dd, &dir_st) != 0)
+			goto out;
+		e = devdir_find(dd, st.st_rdev);
+	}
+
+	if (e == NULL)
+		errno = EBADF;
+	else if ((size_t)snprintf(path, path_size, "%s/%s", DEVQ_DRIDEV_DIR,
+	    e->name) >= path_size)
+		errno = ENAMETOOLONG;
+	else
+		ret = 0;
+
+out:
+	pthread_mutex_unlock(&dd->lock);
+
+	return (ret);
+}
+
+static int
+freebsd_fd_paths(const int *fds, size_t nfds,
+    void (*found)(void *arg, size_t i, const char *path), void *arg)
+{
+	char path[PATH_MAX];
+	size_t i;
+
+	for (i = 0; i < nfds; i++) {
+		if (freebsd_fd_path(fds[i], path, sizeof(path)) == 0)
+			found(arg, i, path);
+	}
+
+	return (0);
+}
+#endif /* defined(HAVE_LIBPROCSTAT_H) */
+
+/*
+ * The children of a node are found with the sysctl.next oid, {0, 2},
+ * which returns the leaf following an oid: the leaf following
+ * {node, child, INT_MAX} is the first one of the next child, so each
+ * step costs that and a sysctl.name, {0, 1}, for its number.
+ */
+static int
+freebsd_sysctl_iter(struct devq_sysctl_iter *it, const char *name,
+    int *index)
+{
+	int qoid[2 + DEVQ_SYSCTL_MAXNAME], oid[DEVQ_SYSCTL_MAXNAME];
+	char child_name[128], *p, *end;
+	size_t len, qlen;
+	long n;
+
+	if (it->miblen == 0) {
+		len = DEVQ_SYSCTL_MAXNAME - 2;
+		if (sysctlnametomib(name, it->mib, &len) != 0)
+			return (-1);
+		it->miblen = len;
+		it->child = -1;
+	}
+
+	for (;;) {
+		qoid[0] = 0;
+		qoid[1] = 2;
+		memcpy(qoid + 2, it->mib, it->miblen * sizeof(int));
+		qlen = 2 + it->miblen;
+		if (it->child != -1) {
+			qoid[qlen++] = it->child;
+			qoid[qlen++] = INT_MAX;
+		}
+
+		len = sizeof(oid);
+		if (sysctl(qoid, qlen, oid, &len, NULL, 0) != 0)
+			return (-1);
+		len /= sizeof(int);
+		if (len <= it->miblen ||
+		    memcmp(oid, it->mib, it->miblen * sizeof(int)) != 0) {
+			errno = ENOENT;
+			return (-1);
+		}
+		it->child = oid[it->miblen];
+
+		qoid[1] = 1;
+		qlen = 2 + it->miblen;
+		qoid[qlen++] = it->child;
+		len = sizeof(child_name);
+		if (sysctl(qoid, qlen, child_name, &len, NULL, 0) != 0)
+			return (-1);
+
+		/* Named children, such as hw.dri.debug, are not wanted */
+		p = strrchr(child_name, '.');
+		p = p != NULL ? p + 1 : child_name;
+		n = strtol(p, &end, 10);
+		if (end != p && *end == '\0' && n >= 0 && n <= INT_MAX) {
+			*index = (int)n;
+			return (0);
+		}
+	}
+}
+
+static int
+pci_getconf(void *arg, struct pci_conf_io *pc)
+{
+	int *fd = arg;
+
+	return (ioctl(*fd, PCIOCGETCONF, pc));
+}
+
+/*
+ * All the display-class functions of the PCI bus, matched by the
+ * kernel.
+ */
+static int
+freebsd_pci_funcs(struct devq_pci_func *funcs, size_t *nfuncs)
+{
+	int fd, ret;
+
+	fd = open("/dev/pci", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return (-1);
+
+	ret = _devq_pci_getconf_funcs(pci_getconf, &fd, funcs, nfuncs);
+
+	close(fd);
+
+	return (ret);
+}
+
+static const struct devq_backend freebsd_backend = {
+	.sysctlbyname	= sysctlbyname,
+	.sysctlnametomib = sysctlnametomib,
+	.sysctl		= sysctl,
+	.fstat		= fstat,
+	.fd_path	= freebsd_fd_path,
+	.fd_paths	= freebsd_fd_paths,
+	.sysctl_iter	= freebsd_sysctl_iter,
+	.pci_funcs	= freebsd_pci_funcs,
+};
+
+const struct devq_backend *_devq_backend = &freebsd_backend;
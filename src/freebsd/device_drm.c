@@ -26,73 +26,492 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/sysctl.h>
 
 #include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "libdevq.h"
+#include "devq_private.h"
 
-int
-devq_device_drm_get_drvname_from_fd(int fd,
-    char *driver_name, size_t *driver_name_len)
+/*
+ * Process-wide cache of the DRM topology: what would otherwise take a
+ * walk of hw.dri.* and dev.vgapci.* for every query, indexed by the
+ * st_rdev of the device nodes. The topology only changes when a DRM
+ * device or a vgapci device comes or goes, which the event monitors
+ * report through _devq_drm_invalidate(). A lookup for an unknown device
+ * also refreshes the cache once, so a device attached while no monitor
+ * was running is still found.
+ */
+struct drm_cache {
+	pthread_mutex_t		lock;
+	atomic_uint		gen;	/* bumped by _devq_drm_invalidate() */
+	unsigned int		built;	/* gen the nodes were read at */
+	int			valid;
+	int			nnodes;
+	int			size;
+	struct devq_drm_node	*nodes;
+};
+
+static struct drm_cache drm_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ * The sysctl MIBs read by the cache, by name: a name is resolved by the
+ * kernel once, then read by number. As a device that went away may come
+ * back under the number of another, the MIBs are forgotten whenever the
+ * DRM topology is read again, whether a monitor saw it change or a
+ * device was not found in it. Used with the cache locked.
+ */
+#define	MIB_BUCKETS	64
+
+struct mib_entry {
+	struct mib_entry	*next;
+	size_t			miblen;		/* 0 if not resolved */
+	int			mib[DEVQ_SYSCTL_MAXNAME];
+	char			name[];
+};
+
+static struct mib_entry *mib_cache[MIB_BUCKETS];
+
+static void
+mib_flush(void)
 {
-	int ret, i;
-	struct stat st;
+	struct mib_entry *e;
+	int i;
+
+	for (i = 0; i < MIB_BUCKETS; i++) {
+		while ((e = mib_cache[i]) != NULL) {
+			mib_cache[i] = e->next;
+			free(e);
+		}
+	}
+}
+
+static int
+drm_sysctl(const char *name, void *value, size_t *value_len)
+{
+	struct mib_entry *e, **bucket;
+	const char *p;
+	size_t len;
+	unsigned int h;
+
+	for (h = 0, p = name; *p != '\0'; p++)
+		h = h * 31 + (unsigned char)*p;
+	bucket = &mib_cache[h % MIB_BUCKETS];
+
+	for (e = *bucket; e != NULL; e = e->next) {
+		if (strcmp(e->name, name) == 0)
+			break;
+	}
+
+	if (e == NULL) {
+		len = strlen(name) + 1;
+		e = malloc(sizeof(*e) + len);
+		if (e == NULL)
+			return (_devq_backend->sysctlbyname(name, value,
+			    value_len, NULL, 0));
+		memcpy(e->name, name, len);
+		e->miblen = 0;
+		e->next = *bucket;
+		*bucket = e;
+	} else if (e->miblen > 0) {
+		len = *value_len;
+		if (_devq_backend->sysctl(e->mib, e->miblen, value, &len,
+		    NULL, 0) == 0) {
+			*value_len = len;
+			return (0);
+		}
+		if (errno != ENOENT)
+			return (-1);
+	}
+
+	e->miblen = DEVQ_SYSCTL_MAXNAME;
+	if (_devq_backend->sysctlnametomib(name, e->mib, &e->miblen) != 0) {
+		e->miblen = 0;
+		return (-1);
+	}
+
+	return (_devq_backend->sysctl(e->mib, e->miblen, value, value_len,
+	    NULL, 0));
+}
+
+static int
+vgapci_busaddr(int i, int *domain, int *bus, int *slot, int *function)
+{
+	int ret;
 	char sysctl_name[32], sysctl_value[128];
+	size_t sysctl_value_len;
+
+	sprintf(sysctl_name, "dev.vgapci.%d.%%location", i);
+
+	sysctl_value_len = sizeof(sysctl_value);
+	memset(sysctl_value, 0, sysctl_value_len);
+	ret = drm_sysctl(sysctl_name, sysctl_value, &sysctl_value_len);
+	if (ret != 0)
+		return (-1);
+
+	/*
+	 * dev.vgapci.$m.%location can have two formats:
+	 *     o  "pci0:2:0:0 handle=\_SB_.PCI0.PEG3.MXM3" (FreeBSD 11+)
+	 *     o  "slot=1 function=0" (up-to FreeBSD 10)
+	 */
+
+	ret = sscanf(sysctl_value, "pci%d:%d:%d:%d %*s",
+	    domain, bus, slot, function);
+	if (ret == 4)
+		return (0);
+
+	ret = sscanf(sysctl_value, "slot=%d function=%d %*s",
+	    slot, function);
+	if (ret != 2)
+		return (-1);
+
+	sprintf(sysctl_name, "dev.vgapci.%d.%%parent", i);
+
+	sysctl_value_len = sizeof(sysctl_value);
+	memset(sysctl_value, 0, sysctl_value_len);
+	ret = drm_sysctl(sysctl_name, sysctl_value, &sysctl_value_len);
+	if (ret != 0)
+		return (-1);
+
+	ret = sscanf(sysctl_value, "pci%d", bus);
+	if (ret != 1)
+		return (-1);
+
+	/* FIXME: What domain to assume? */
+	*domain = 0;
+
+	return (0);
+}
+
+/*
+ * Read hw.dri.$n: the driver name and device number from
+ * hw.dri.$n.name (eg. "radeon 0x9b"), and the location of the device
+ * on the PCI bus from hw.dri.$n.busid.
+ */
+static int
+drm_read_dri(int i, struct devq_drm_node *node)
+{
+	int ret;
+	char sysctl_name[32], sysctl_value[128];
+	const char *busid_format;
 	size_t sysctl_value_len, name_len;
-	long dev;
 
-	ret = fstat(fd, &st);
+	sprintf(sysctl_name, "hw.dri.%d.name", i);
+
+	sysctl_value_len = sizeof(sysctl_value) - 1;
+	memset(sysctl_value, 0, sizeof(sysctl_value));
+	ret = drm_sysctl(sysctl_name, sysctl_value, &sysctl_value_len);
 	if (ret != 0)
 		return (-1);
-	if (!S_ISCHR(st.st_mode)) {
-		errno = EBADF;
+
+	for (name_len = 0;
+	    name_len < sysctl_value_len &&
+	    sysctl_value[name_len] != ' ';
+	    ++name_len)
+		;
+	if (name_len >= sizeof(node->driver))
 		return (-1);
+
+	memset(node, 0, sizeof(*node));
+	node->dri = i;
+	memcpy(node->driver, sysctl_value, name_len);
+	node->driver_len = name_len;
+	node->rdev = (dev_t)strtol(sysctl_value + name_len, NULL, 16);
+	node->vgapci = -1;
+	node->pciid_error = ENOENT;
+
+	/* The domain, bus and slot of a busid are in hexadecimal. */
+	busid_format = "%*s %*s pci:%x:%x:%x.%d";
+
+	sprintf(sysctl_name, "hw.dri.%d.busid", i);
+
+	sysctl_value_len = sizeof(sysctl_value) - 1;
+	memset(sysctl_value, 0, sizeof(sysctl_value));
+	ret = drm_sysctl(sysctl_name, sysctl_value, &sysctl_value_len);
+	if (ret == 0) {
+		busid_format = "pci:%x:%x:%x.%d";
+	} else {
+		/*
+		 * If hw.dri.$n.busid isn't available, fallback on
+		 * hw.dri.$n.name, read again as the buffer was reused.
+		 */
+		sprintf(sysctl_name, "hw.dri.%d.name", i);
+		sysctl_value_len = sizeof(sysctl_value) - 1;
+		memset(sysctl_value, 0, sizeof(sysctl_value));
+		ret = drm_sysctl(sysctl_name, sysctl_value, &sysctl_value_len);
+	}
+
+	if (ret != 0) {
+		node->busaddr_error = errno;
+	} else if (sscanf(sysctl_value, busid_format,
+	    &node->domain, &node->bus, &node->slot, &node->function) != 4) {
+		node->busaddr_error = ENOENT;
+	}
+
+	return (0);
+}
+
+/*
+ * Read the PCI IDs of dev.vgapci.$m into node.
+ */
+static void
+drm_read_pciid(int i, struct devq_drm_node *node)
+{
+	int ret;
+	char sysctl_name[32], sysctl_value[128];
+	size_t sysctl_value_len;
+
+	node->vgapci = i;
+
+	sprintf(sysctl_name, "dev.vgapci.%d.%%pnpinfo", i);
+
+	sysctl_value_len = sizeof(sysctl_value) - 1;
+	memset(sysctl_value, 0, sizeof(sysctl_value));
+	ret = drm_sysctl(sysctl_name, sysctl_value, &sysctl_value_len);
+	if (ret != 0) {
+		node->pciid_error = errno;
+		return;
+	}
+
+	ret = sscanf(sysctl_value, "vendor=0x%04x device=0x%04x subvendor=0x%04x subdevice=0x%04x",
+	    &node->vendor_id, &node->device_id,
+	    &node->subvendor_id, &node->subdevice_id);
+	if (ret != 4) {
+		node->pciid_error = EINVAL;
+		return;
+	}
+
+	/* Not found in dev.vgapci, only through /dev/pci */
+	node->revision_id = 0;
+	node->pciid_error = 0;
+}
+
+/*
+ * Fill the PCI IDs of the DRM devices from the list of display-class
+ * PCI functions, matched on their location. Returns the number of
+ * devices left without them.
+ */
+static int
+drm_match_pci(struct drm_cache *c)
+{
+	struct devq_pci_func *funcs, *f;
+	struct devq_drm_node *node;
+	size_t i, n, size;
+	int j, unmatched;
+
+	funcs = NULL;
+	size = 16;
+	for (;;) {
+		f = reallocarray(funcs, size, sizeof(*funcs));
+		if (f == NULL)
+			break;
+		funcs = f;
+		n = size;
+		if (_devq_backend->pci_funcs(funcs, &n) != 0)
+			n = 0;
+		if (n <= size)
+			break;
+		size = n;
+	}
+	if (f == NULL)
+		n = 0;
+
+	unmatched = 0;
+	for (j = 0; j < c->nnodes; j++) {
+		node = &c->nodes[j];
+		if (node->busaddr_error != 0)
+			continue;
+
+		for (i = 0; i < n; i++) {
+			f = &funcs[i];
+			if (node->domain == f->domain &&
+			    node->bus == f->bus &&
+			    node->slot == f->slot &&
+			    node->function == f->function)
+				break;
+		}
+		if (i == n) {
+			unmatched++;
+			continue;
+		}
+
+		node->vendor_id = f->vendor_id;
+		node->device_id = f->device_id;
+		node->subvendor_id = f->subvendor_id;
+		node->subdevice_id = f->subdevice_id;
+		node->revision_id = f->revision_id;
+		node->pciid_error = 0;
+	}
+
+	free(funcs);
+
+	return (unmatched);
+}
+
+/*
+ * Walk hw.dri.* then dev.vgapci.* once, matching vgapci devices to
+ * DRM devices by their location on the PCI bus. Called with the cache
+ * locked.
+ */
+static void
+drm_cache_build(struct drm_cache *c)
+{
+	int i, j, unmatched, domain, bus, slot, function;
+	struct devq_drm_node *node;
+	struct devq_sysctl_iter it;
+
+	c->built = atomic_load(&c->gen);
+	mib_flush();
+
+	c->nnodes = 0;
+	memset(&it, 0, sizeof(it));
+	while (_devq_backend->sysctl_iter(&it, "hw.dri", &i) == 0) {
+		if (c->nnodes == c->size) {
+			node = reallocarray(c->nodes, c->size + 8,
+			    sizeof(*node));
+			if (node == NULL)
+				break;
+			c->nodes = node;
+			c->size += 8;
+		}
+		if (drm_read_dri(i, &c->nodes[c->nnodes]) == 0)
+			c->nnodes++;
 	}
 
 	/*
-	 * Walk all the hw.dri.$n tree and compare the number stored at
-	 * the end of hw.dri.$n.name (eg. "radeon 0x9b") to the value in
-	 * stat.st_rdev.
+	 * The PCI bus gives the IDs of every device at once. The devices
+	 * it does not, as when /dev/pci cannot be opened, are looked for
+	 * in dev.vgapci, until every one has been found.
 	 */
-	for (i = 0; i < DEVQ_MAX_DEVS; i++) {
-		sprintf(sysctl_name, "hw.dri.%d.name", i);
+	unmatched = drm_match_pci(c);
 
-		sysctl_value_len = sizeof(sysctl_value);
-		ret = sysctlbyname(sysctl_name, sysctl_value,
-		    &sysctl_value_len, NULL, 0);
-		if (ret != 0)
+	memset(&it, 0, sizeof(it));
+	while (unmatched > 0 &&
+	    _devq_backend->sysctl_iter(&it, "dev.vgapci", &i) == 0) {
+		if (vgapci_busaddr(i, &domain, &bus, &slot, &function) != 0)
 			continue;
 
-		for (name_len = 0;
-		    name_len < sysctl_value_len &&
-		    sysctl_value[name_len] != ' ';
-		    ++name_len)
-			;
-		if (driver_name != NULL) {
-			if (*driver_name_len < name_len) {
-				*driver_name_len = name_len;
-				errno = ENOMEM;
-				return (-1);
+		for (j = 0; j < c->nnodes; j++) {
+			node = &c->nodes[j];
+			if (node->busaddr_error == 0 &&
+			    node->pciid_error == ENOENT &&
+			    node->domain == domain &&
+			    node->bus == bus &&
+			    node->slot == slot &&
+			    node->function == function) {
+				drm_read_pciid(i, node);
+				unmatched--;
 			}
-
-			memcpy(driver_name, sysctl_value, name_len);
 		}
-		if (driver_name_len)
-			*driver_name_len = name_len;
+	}
 
-		/*
-		 * Now that we found the correct entry, return its
-		 * number; this could be useful to others.
-		 */
-		dev = strtol(sysctl_value + name_len, NULL, 16);
-		if (dev == (long)st.st_rdev)
-			return (i);
+	c->valid = 1;
+}
+
+static const struct devq_drm_node *
+drm_cache_find(struct drm_cache *c, dev_t rdev)
+{
+	int i;
+
+	for (i = 0; i < c->nnodes; i++) {
+		if (c->nodes[i].rdev == rdev)
+			return (&c->nodes[i]);
 	}
 
-	errno = ENOENT;
-	return (-1);
+	return (NULL);
+}
+
+/*
+ * Copy the cached DRM node of the device behind fd into node.
+ */
+int
+_devq_drm_node_from_fd(int fd, struct devq_drm_node *node)
+{
+	int ret;
+	struct stat st;
+	const struct devq_drm_node *found;
+	struct drm_cache *c;
+
+	ret = _devq_backend->fstat(fd, &st);
+	if (ret != 0)
+		return (-1);
+	if (!S_ISCHR(st.st_mode)) {
+		errno = EBADF;
+		return (-1);
+	}
+
+	c = &drm_cache;
+	pthread_mutex_lock(&c->lock);
+
+	found = NULL;
+	if (c->valid && c->built == atomic_load(&c->gen))
+		found = drm_cache_find(c, st.st_rdev);
+	if (found == NULL) {
+		drm_cache_build(c);
+		found = drm_cache_find(c, st.st_rdev);
+	}
+	if (found != NULL)
+		memcpy(node, found, sizeof(*node));
+
+	pthread_mutex_unlock(&c->lock);
+
+	if (found == NULL) {
+		errno = ENOENT;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Forget the DRM topology; it is read again on the next lookup. This
+ * does not take the cache lock so that the event monitors never wait
+ * on a lookup.
+ */
+void
+_devq_drm_invalidate(void)
+{
+
+	atomic_fetch_add(&drm_cache.gen, 1);
+}
+
+/*
+ * Bumped by every _devq_drm_invalidate(), for the caches depending on
+ * the DRM devices.
+ */
+unsigned int
+_devq_drm_generation(void)
+{
+
+	return (atomic_load(&drm_cache.gen));
+}
+
+/*
+ * Whether a devd line reports a change of the DRM topology: a DRM or
+ * vgapci device attached or detached ("+vgapci0 at ...", "-drmn0 ..."),
+ * or a DRM device node created or destroyed
+ * ("!system=DEVFS subsystem=CDEV type=CREATE cdev=dri/card0").
+ */
+int
+_devq_drm_event(const char *line, size_t len)
+{
+	static const char cdev[] = " cdev=dri/";
+
+	switch (*line) {
+	case '+':
+	case '-':
+		line++;
+		len--;
+		return ((len >= 6 && memcmp(line, "vgapci", 6) == 0) ||
+		    (len >= 3 && memcmp(line, "drm", 3) == 0));
+	case '!':
+		return (len > 14 && memcmp(line + 1, "system=DEVFS", 12) == 0 &&
+		    memmem(line, len, cdev, sizeof(cdev) - 1) != NULL);
+	default:
+		return (0);
+	}
 }
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2014 Jean-Sebastien Pedron <dumbbell@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The display-class functions of the PCI bus, as PCIOCGETCONF lists
+ * them, apart from /dev/pci so that any getconf may stand for it.
+ */
+
+#include <sys/types.h>
+#include <sys/pciio.h>
+
+#include <dev/pci/pcireg.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include "devq_private.h"
+
+/* Matches per PCIOCGETCONF */
+#define	PCI_CONF_BATCH	32
+
+static void
+pci_func_from_conf(struct devq_pci_func *f, const struct pci_conf *p)
+{
+
+	f->domain = p->pc_sel.pc_domain;
+	f->bus = p->pc_sel.pc_bus;
+	f->slot = p->pc_sel.pc_dev;
+	f->function = p->pc_sel.pc_func;
+	f->vendor_id = p->pc_vendor;
+	f->device_id = p->pc_device;
+	f->subvendor_id = p->pc_subvendor;
+	f->subdevice_id = p->pc_subdevice;
+	f->revision_id = p->pc_revid;
+}
+
+/*
+ * A single getconf unless there are more functions than fit in conf.
+ * The kernel matches them, and tells when the bus changed since the
+ * first call: the list is then read again from the start.
+ */
+int
+_devq_pci_getconf_funcs(int (*getconf)(void *arg, struct pci_conf_io *pc),
+    void *arg, struct devq_pci_func *funcs, size_t *nfuncs)
+{
+	struct pci_conf_io pc;
+	struct pci_match_conf pattern;
+	struct pci_conf conf[PCI_CONF_BATCH];
+	size_t n;
+	u_int i;
+	int retries;
+
+	memset(&pattern, 0, sizeof(pattern));
+	pattern.pc_class = PCIC_DISPLAY;
+	pattern.flags = PCI_GETCONF_MATCH_CLASS;
+
+	memset(&pc, 0, sizeof(pc));
+	pc.pat_buf_len = sizeof(pattern);
+	pc.num_patterns = 1;
+	pc.patterns = &pattern;
+	pc.match_buf_len = sizeof(conf);
+	pc.matches = conf;
+
+	n = 0;
+	retries = 0;
+	do {
+		if (getconf(arg, &pc) != 0)
+			return (-1);
+
+		switch (pc.status) {
+		case PCI_GETCONF_LIST_CHANGED:
+			if (++retries > DEVQ_PCI_RETRIES) {
+				errno = EAGAIN;
+				return (-1);
+			}
+			pc.offset = 0;
+			pc.generation = 0;
+			n = 0;
+			continue;
+		case PCI_GETCONF_ERROR:
+			errno = EIO;
+			return (-1);
+		default:
+			break;
+		}
+
+		for (i = 0; i < pc.num_matches; i++, n++) {
+			if (n < *nfuncs)
+				pci_func_from_conf(&funcs[n], &conf[i]);
+		}
+	} while (pc.status != PCI_GETCONF_LAST_DEVICE);
+
+	*nfuncs = n;
+
+	return (0);
+}
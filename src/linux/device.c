@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2014 Jean-Sebastien Pedron <dumbbell@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libdevq.h"
+#include "devq_private.h"
+
+/*
+ * /proc/self/fd, where the link named after a descriptor points to the
+ * file opened. The directory is that of the process which opened it,
+ * so a child forgets it.
+ */
+#define	PROC_SELF_FD	"/proc/self/fd"
+
+static pthread_mutex_t proc_fd_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t proc_fd_once = PTHREAD_ONCE_INIT;
+static int proc_fd = -1;
+
+static void
+proc_fd_atfork_child(void)
+{
+
+	if (proc_fd >= 0)
+		close(proc_fd);
+	proc_fd = -1;
+	pthread_mutex_init(&proc_fd_lock, NULL);
+}
+
+static void
+proc_fd_init(void)
+{
+
+	pthread_atfork(NULL, NULL, proc_fd_atfork_child);
+}
+
+static ssize_t
+proc_fd_path(int fd, char *path, size_t path_size)
+{
+	char name[16];
+	ssize_t len;
+
+	pthread_once(&proc_fd_once, proc_fd_init);
+
+	snprintf(name, sizeof(name), "%d", fd);
+
+	pthread_mutex_lock(&proc_fd_lock);
+	if (proc_fd < 0)
+		proc_fd = open(PROC_SELF_FD,
+		    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (proc_fd < 0)
+		len = -1;
+	else
+		len = readlinkat(proc_fd, name, path, path_size);
+	pthread_mutex_unlock(&proc_fd_lock);
+
+	if (len < 0) {
+		if (errno == ENOENT)
+			errno = EBADF;
+		return (-1);
+	}
+	if ((size_t)len == path_size) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+
+	return (len);
+}
+
+int
+devq_device_get_devpath_from_fd(int fd,
+    char *path, size_t *path_len)
+{
+	char tmp_path[PATH_MAX];
+	ssize_t len;
+
+	len = proc_fd_path(fd, tmp_path, sizeof(tmp_path));
+	if (len < 0)
+		return (-1);
+
+	if (path) {
+		if (*path_len < (size_t)len) {
+			*path_len = len;
+			errno = ENOMEM;
+			return (-1);
+		}
+
+		memcpy(path, tmp_path, len);
+	}
+	if (path_len)
+		*path_len = len;
+
+	return (0);
+}
+
+int
+devq_device_get_devpaths_from_fds(const int *fds, size_t nfds,
+    char **paths, size_t *paths_len)
+{
+	char tmp_path[PATH_MAX], *out;
+	size_t i, len, size;
+	ssize_t n;
+	int found;
+
+	if ((fds == NULL && nfds > 0) || paths == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	/* /proc is read per descriptor: there is no table to fetch */
+	out = NULL;
+	len = size = 0;
+	found = 0;
+	for (i = 0; i < nfds; i++) {
+		n = proc_fd_path(fds[i], tmp_path, sizeof(tmp_path));
+		if (n < 0)
+			n = 0;
+		else
+			found++;
+
+		if (out == NULL || len + n + 1 > size) {
+			size = size > 0 ? size : 256;
+			while (len + n + 1 > size)
+				size *= 2;
+			out = reallocf(out, size);
+			if (out == NULL)
+				return (-1);
+		}
+		memcpy(out + len, tmp_path, n);
+		len += n;
+		out[len++] = '\0';
+	}
+
+	if (out == NULL && (out = malloc(1)) == NULL)
+		return (-1);
+
+	*paths = out;
+	if (paths_len)
+		*paths_len = len;
+
+	return (found);
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2014 Jean-Sebastien Pedron <dumbbell@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libdevq.h"
+#include "devq_private.h"
+
+/*
+ * On Linux, a DRM device node is found from its st_rdev under
+ * /sys/dev/char/$major:$minor, a link to the DRM device (eg.
+ * ../../devices/pci0000:00/0000:00:02.0/drm/card0). Its "device" link
+ * is the PCI device, whose attributes are read directly: no tree walk
+ * is needed and nothing is cached but the /sys/dev/char directory.
+ */
+#define	SYSFS_DEV_CHAR	"/sys/dev/char"
+
+static atomic_int sysfs_dev_char = -1;
+
+static int
+sysfs_dirfd(void)
+{
+	int fd, expected;
+
+	fd = atomic_load(&sysfs_dev_char);
+	if (fd >= 0)
+		return (fd);
+
+	fd = open(SYSFS_DEV_CHAR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return (-1);
+
+	/* Another thread may have opened it meanwhile. */
+	expected = -1;
+	if (!atomic_compare_exchange_strong(&sysfs_dev_char, &expected, fd)) {
+		close(fd);
+		fd = expected;
+	}
+
+	return (fd);
+}
+
+/*
+ * Last component of the target of the link at dirfd/path.
+ */
+static int
+sysfs_link_name(int dirfd, const char *path, char *name, size_t size)
+{
+	char target[PATH_MAX];
+	const char *base;
+	ssize_t len;
+
+	len = readlinkat(dirfd, path, target, sizeof(target) - 1);
+	if (len < 0)
+		return (-1);
+	target[len] = '\0';
+
+	base = strrchr(target, '/');
+	base = base != NULL ? base + 1 : target;
+	if (strlcpy(name, base, size) >= size) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Read a sysfs attribute holding a number, eg. "0x8086\n".
+ */
+static int
+sysfs_read_int(int dirfd, const char *path, int *value)
+{
+	char buf[32], *end;
+	ssize_t len;
+	int fd;
+
+	fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return (-1);
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	buf[len] = '\0';
+
+	*value = (int)strtol(buf, &end, 0);
+	if (end == buf) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	return (0);
+}
+
+static int
+sysfs_read_pciid(int devfd, struct devq_drm_node *node)
+{
+
+	if (sysfs_read_int(devfd, "vendor", &node->vendor_id) != 0 ||
+	    sysfs_read_int(devfd, "device", &node->device_id) != 0 ||
+	    sysfs_read_int(devfd, "subsystem_vendor",
+	    &node->subvendor_id) != 0 ||
+	    sysfs_read_int(devfd, "subsystem_device",
+	    &node->subdevice_id) != 0 ||
+	    sysfs_read_int(devfd, "revision", &node->revision_id) != 0)
+		return (errno);
+
+	return (0);
+}
+
+/*
+ * Read the DRM device behind fd from sysfs into node.
+ */
+int
+_devq_drm_node_from_fd(int fd, struct devq_drm_node *node)
+{
+	int ret, dirfd, devfd;
+	struct stat st;
+	char path[32], name[DEVQ_DEVNAME_MAX], target[PATH_MAX];
+	const char *num;
+	ssize_t len;
+
+	ret = fstat(fd, &st);
+	if (ret != 0)
+		return (-1);
+	if (!S_ISCHR(st.st_mode)) {
+		errno = EBADF;
+		return (-1);
+	}
+
+	dirfd = sysfs_dirfd();
+	if (dirfd < 0)
+		return (-1);
+
+	/* Only DRM devices, whose sysfs path is .../drm/$name. */
+	snprintf(path, sizeof(path), "%u:%u",
+	    major(st.st_rdev), minor(st.st_rdev));
+	len = readlinkat(dirfd, path, target, sizeof(target) - 1);
+	if (len < 0)
+		return (-1);
+	target[len] = '\0';
+	if (strstr(target, "/drm/") == NULL) {
+		errno = ENOENT;
+		return (-1);
+	}
+
+	memset(node, 0, sizeof(*node));
+	node->rdev = st.st_rdev;
+	node->vgapci = -1;
+
+	/* The number of card0 or renderD128. */
+	for (num = target + len; num > target && num[-1] >= '0' &&
+	    num[-1] <= '9'; num--)
+		;
+	node->dri = atoi(num);
+
+	snprintf(path, sizeof(path), "%u:%u/device",
+	    major(st.st_rdev), minor(st.st_rdev));
+	devfd = openat(dirfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (devfd < 0)
+		return (-1);
+
+	ret = sysfs_link_name(devfd, "driver", node->driver,
+	    sizeof(node->driver));
+	if (ret != 0) {
+		close(devfd);
+		return (-1);
+	}
+	node->driver_len = strlen(node->driver);
+
+	/* The device is named after its PCI location, eg. 0000:00:02.0. */
+	if (sysfs_link_name(dirfd, path, name, sizeof(name)) != 0)
+		node->busaddr_error = errno;
+	else if (sscanf(name, "%x:%x:%x.%x", &node->domain, &node->bus,
+	    &node->slot, &node->function) != 4)
+		node->busaddr_error = ENOENT;
+
+	if (node->busaddr_error != 0)
+		node->pciid_error = ENOENT;
+	else
+		node->pciid_error = sysfs_read_pciid(devfd, node);
+
+	close(devfd);
+
+	return (0);
+}
+
+/*
+ * Nothing to forget: sysfs is read on every query.
+ */
+void
+_devq_drm_invalidate(void)
+{
+
+}
+
+unsigned int
+_devq_drm_generation(void)
+{
+
+	return (0);
+}
+
+int
+_devq_drm_event(const char *line, size_t len)
+{
+
+	(void)line;
+	(void)len;
+	return (0);
+}
@@ -0,0 +1,515 @@
+/*
+ * Copyright (c) 2014 Baptiste Daroussin <bapt@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Linux side of the event monitor: kernel uevents, read from a
+ * NETLINK_KOBJECT_UEVENT socket with recvmmsg(2), many messages per
+ * call, and turned into devd(8) lines:
+ *
+ *     add@/devices/.../input/input5/event3\0ACTION=add\0DEVNAME=input/event3\0...
+ *
+ * becomes
+ *
+ *     +input/event3 at action=add devname=input/event3 ...
+ *
+ * ACTION=remove gives a "-" line and any other action a notice:
+ * "!system=$SUBSYSTEM subsystem=$DEVTYPE type=$ACTION ...". The device
+ * is named after its node under /dev, or else the last component of
+ * its path. The vendor and product of PRODUCT or PCI_ID become vendor=
+ * and product=, as devd reports them, after id_bus=usb, id_bus=pci or
+ * the bus type of another input device, telling which database names
+ * them.
+ *
+ * Any datagram or sequenced-packet socket carrying uevents may be given
+ * to devq_event_monitor_init_fd(), such as one end of a socketpair(2).
+ */
+
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "devq_private.h"
+
+#define	UEVENT_MSG_MAX		4096	/* above the kernel's 2048 of env */
+#define	UEVENT_LINE_MAX		(2 * UEVENT_MSG_MAX + 64)
+#define	UEVENT_BATCH		16	/* messages per recvmmsg(2) */
+#define	UEVENT_RCVBUF		(1024 * 1024)
+#define	UEVENT_GROUP_KERNEL	1
+
+struct devq_evmon_os {
+	int fd;
+	int ep;		/* epoll instance, returned as the monitor fd */
+	int efd;	/* eventfd signaling lines already buffered */
+	unsigned int next;	/* next message to turn into a line */
+	unsigned int count;	/* messages received */
+	struct mmsghdr msgs[UEVENT_BATCH];
+	struct iovec iov[UEVENT_BATCH];
+	struct sockaddr_nl addr[UEVENT_BATCH];
+	char bufs[UEVENT_BATCH][UEVENT_MSG_MAX];
+};
+
+/* A line being written into the receive buffer */
+struct uevent_out {
+	char *p;
+	size_t left;
+	int overflow;
+};
+
+int
+_devq_evmon_os_connect(void)
+{
+	struct sockaddr_nl	 nl;
+	int			 fd, size;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+	    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return (-1);
+
+	/* Bursts of uevents, at boot or on hotplug, must not overflow it */
+	size = UEVENT_RCVBUF;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	memset(&nl, 0, sizeof(nl));
+	nl.nl_family = AF_NETLINK;
+	nl.nl_groups = UEVENT_GROUP_KERNEL;
+	if (bind(fd, (struct sockaddr *)&nl, sizeof(nl)) < 0) {
+		close(fd);
+		return (-1);
+	}
+
+	return (fd);
+}
+
+struct devq_evmon_os *
+_devq_evmon_os_init(int fd, size_t *recv_min)
+{
+	struct devq_evmon_os	*os;
+	struct epoll_event	 ev;
+
+	if ((os = calloc(1, sizeof(*os))) == NULL)
+		return (NULL);
+
+	os->fd = fd;
+	os->ep = epoll_create1(EPOLL_CLOEXEC);
+	os->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (os->ep < 0 || os->efd < 0)
+		goto fail;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (fd >= 0 && epoll_ctl(os->ep, EPOLL_CTL_ADD, fd, &ev) < 0)
+		goto fail;
+
+	/* Edge-triggered, to fire once per wakeup as EVFILT_USER does */
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = os->efd;
+	if (epoll_ctl(os->ep, EPOLL_CTL_ADD, os->efd, &ev) < 0)
+		goto fail;
+
+	*recv_min = UEVENT_LINE_MAX;
+
+	return (os);
+
+fail:
+	if (os->ep >= 0)
+		close(os->ep);
+	if (os->efd >= 0)
+		close(os->efd);
+	free(os);
+	return (NULL);
+}
+
+void
+_devq_evmon_os_fini(struct devq_evmon_os *os)
+{
+
+	close(os->ep);
+	close(os->efd);
+	free(os);
+}
+
+int
+_devq_evmon_os_fd(struct devq_evmon_os *os)
+{
+
+	return (os->ep);
+}
+
+int
+_devq_evmon_os_wait(struct devq_evmon_os *os, int timeout)
+{
+	struct epoll_event ev[2];
+	uint64_t val;
+	int i, n;
+
+	n = epoll_wait(os->ep, ev, 2, timeout);
+	if (n <= 0)
+		return (n);
+
+	for (i = 0; i < n; i++) {
+		if (ev[i].data.fd == os->efd)
+			(void)read(os->efd, &val, sizeof(val));
+	}
+
+	return (1);
+}
+
+void
+_devq_evmon_os_wakeup(struct devq_evmon_os *os)
+{
+	uint64_t one;
+
+	one = 1;
+	(void)write(os->efd, &one, sizeof(one));
+}
+
+static void
+out_write(struct uevent_out *out, const char *s, size_t len)
+{
+
+	if (out->overflow || len > out->left) {
+		out->overflow = 1;
+		return;
+	}
+	memcpy(out->p, s, len);
+	out->p += len;
+	out->left -= len;
+}
+
+static void
+out_str(struct uevent_out *out, const char *s)
+{
+
+	out_write(out, s, strlen(s));
+}
+
+/*
+ * Write " key=value", with the key in lower case and the value quoted
+ * if it has blanks; quotes and line breaks are not to be found in the
+ * value of a devd line.
+ */
+static void
+out_attr(struct uevent_out *out, const char *key, size_t key_len,
+    const char *value)
+{
+	const char *v;
+	char c;
+	size_t i;
+	int quote;
+
+	out_write(out, " ", 1);
+	for (i = 0; i < key_len; i++) {
+		c = tolower((unsigned char)key[i]);
+		out_write(out, &c, 1);
+	}
+	out_write(out, "=", 1);
+
+	quote = (*value == '\0');
+	for (v = value; *v != '\0' && !quote; v++)
+		quote = isspace((unsigned char)*v);
+
+	if (quote)
+		out_write(out, "\"", 1);
+	for (v = value; *v != '\0'; v++) {
+		c = *v;
+		if (c == '"')
+			c = '\'';
+		else if (isspace((unsigned char)c))
+			c = ' ';
+		out_write(out, &c, 1);
+	}
+	if (quote)
+		out_write(out, "\"", 1);
+}
+
+/*
+ * Value of key in the environment of a uevent, NUL-separated
+ * "KEY=value" strings.
+ */
+static const char *
+uevent_get(const char *env, const char *end, const char *key)
+{
+	size_t len;
+
+	len = strlen(key);
+	for (; env < end; env += strlen(env) + 1) {
+		if (strncmp(env, key, len) == 0 && env[len] == '=')
+			return (env + len + 1);
+	}
+
+	return (NULL);
+}
+
+/* Bus types of input devices, from <linux/input.h> */
+#define	UEVENT_BUS_PCI		0x01
+#define	UEVENT_BUS_USB		0x03
+
+/*
+ * Vendor and product IDs, from PRODUCT=46d/c077/7200 (USB),
+ * PRODUCT=3/46d/c077/111 (input, after the bus type) or
+ * PCI_ID=8086:1234, and the bus whose database names them: "usb",
+ * "pci", or the bus type of any other input device, as 0x0011.
+ */
+static int
+uevent_ids(const char *env, const char *end, unsigned int *vendor,
+    unsigned int *product, char *bus, size_t bus_size)
+{
+	const char *v;
+	unsigned int type, version;
+
+	if ((v = uevent_get(env, end, "PRODUCT")) != NULL) {
+		if (sscanf(v, "%x/%x/%x/%x", &type, vendor, product,
+		    &version) == 4) {
+			if (type == UEVENT_BUS_USB)
+				strlcpy(bus, "usb", bus_size);
+			else if (type == UEVENT_BUS_PCI)
+				strlcpy(bus, "pci", bus_size);
+			else
+				snprintf(bus, bus_size, "0x%04x", type);
+			return (0);
+		}
+		if (sscanf(v, "%x/%x/", vendor, product) == 2) {
+			strlcpy(bus, "usb", bus_size);
+			return (0);
+		}
+	}
+
+	if ((v = uevent_get(env, end, "PCI_ID")) != NULL &&
+	    sscanf(v, "%x:%x", vendor, product) == 2) {
+		strlcpy(bus, "pci", bus_size);
+		return (0);
+	}
+
+	return (-1);
+}
+
+/*
+ * Turn the uevent msg into a devd line in buf. Returns the length of
+ * the line, 0 if the message is to be dropped or -1 if the line does
+ * not fit.
+ */
+static ssize_t
+uevent_line(const char *msg, size_t len, char *buf, size_t size)
+{
+	struct uevent_out out;
+	const char *env, *end, *action, *devpath, *subsystem, *devtype;
+	const char *name, *eq, *p;
+	unsigned int vendor, product;
+	char ids[40], bus[16];
+	int notice;
+
+	/* "action@devpath", then the environment */
+	end = msg + len;
+	if (memchr(msg, '@', strnlen(msg, len)) == NULL)
+		return (0);
+	env = msg + strnlen(msg, len) + 1;
+	if (env >= end || end[-1] != '\0')
+		return (0);
+
+	action = uevent_get(env, end, "ACTION");
+	devpath = uevent_get(env, end, "DEVPATH");
+	if (action == NULL || devpath == NULL)
+		return (0);
+	subsystem = uevent_get(env, end, "SUBSYSTEM");
+	devtype = uevent_get(env, end, "DEVTYPE");
+
+	if ((name = uevent_get(env, end, "DEVNAME")) == NULL) {
+		name = strrchr(devpath, '/');
+		name = name != NULL ? name + 1 : devpath;
+	}
+	if (*name == '\0')
+		return (0);
+
+	out.p = buf;
+	out.left = size;
+	out.overflow = 0;
+
+	notice = 0;
+	if (strcmp(action, "add") == 0) {
+		out_write(&out, "+", 1);
+	} else if (strcmp(action, "remove") == 0) {
+		out_write(&out, "-", 1);
+	} else {
+		notice = 1;
+		out_write(&out, "!", 1);
+	}
+
+	if (!notice) {
+		for (p = name; *p != '\0'; p++) {
+			if (!isspace((unsigned char)*p))
+				out_write(&out, p, 1);
+		}
+		out_str(&out, " at");
+	} else {
+		out_str(&out, "system=");
+		out_str(&out, subsystem != NULL ? subsystem : "unknown");
+		out_attr(&out, "subsystem", 9, devtype != NULL ? devtype :
+		    subsystem != NULL ? subsystem : "unknown");
+		out_attr(&out, "type", 4, action);
+		if (uevent_get(env, end, "DEVNAME") != NULL)
+			out_attr(&out, "cdev", 4, name);
+	}
+
+	for (p = env; p < end; p += strlen(p) + 1) {
+		if ((eq = strchr(p, '=')) == NULL || eq == p)
+			continue;
+		/* Replaced by vendor= and product= */
+		if (eq - p == 7 && strncmp(p, "PRODUCT", 7) == 0)
+			continue;
+		/* Already given as system=, subsystem= and type= */
+		if (notice && ((eq - p == 6 && strncmp(p, "ACTION", 6) == 0) ||
+		    (eq - p == 9 && strncmp(p, "SUBSYSTEM", 9) == 0) ||
+		    (eq - p == 7 && strncmp(p, "DEVTYPE", 7) == 0)))
+			continue;
+		out_attr(&out, p, eq - p, eq + 1);
+	}
+
+	if (uevent_ids(env, end, &vendor, &product, bus, sizeof(bus)) == 0) {
+		/* The device name does not tell the bus as on FreeBSD */
+		out_attr(&out, "id_bus", 6, bus);
+		snprintf(ids, sizeof(ids), " vendor=0x%04x product=0x%04x",
+		    vendor, product);
+		out_str(&out, ids);
+	}
+
+	out_write(&out, "\n", 1);
+	if (out.overflow)
+		return (-1);
+
+	return (out.p - buf);
+}
+
+/*
+ * Only the kernel is to be trusted on a netlink socket; other sockets,
+ * as those of socketpair(2), have no such address.
+ */
+static int
+uevent_from_kernel(const struct msghdr *hdr)
+{
+	const struct sockaddr_nl *nl;
+
+	if (hdr->msg_namelen < sizeof(*nl))
+		return (1);
+	nl = hdr->msg_name;
+
+	return (nl->nl_family != AF_NETLINK || nl->nl_pid == 0);
+}
+
+static int
+uevent_recv(struct devq_evmon_os *os, int nonblock)
+{
+	struct msghdr *hdr;
+	unsigned int i;
+	int n;
+
+	for (i = 0; i < UEVENT_BATCH; i++) {
+		os->iov[i].iov_base = os->bufs[i];
+		os->iov[i].iov_len = sizeof(os->bufs[i]);
+		hdr = &os->msgs[i].msg_hdr;
+		memset(hdr, 0, sizeof(*hdr));
+		hdr->msg_iov = &os->iov[i];
+		hdr->msg_iovlen = 1;
+		hdr->msg_name = &os->addr[i];
+		hdr->msg_namelen = sizeof(os->addr[i]);
+	}
+
+	n = recvmmsg(os->fd, os->msgs, UEVENT_BATCH,
+	    nonblock ? MSG_DONTWAIT : MSG_WAITFORONE, NULL);
+	if (n < 0)
+		return (-1);
+
+	os->next = 0;
+	os->count = n;
+
+	return (n);
+}
+
+/*
+ * Fill buf with the lines of as many uevents as it holds. Messages that
+ * do not fit are kept for the next call, which then needs no system
+ * call. An empty message is the end of a sequenced-packet stream.
+ */
+ssize_t
+_devq_evmon_os_recv(struct devq_evmon_os *os, char *buf, size_t len,
+    int nonblock)
+{
+	struct mmsghdr *m;
+	ssize_t n, total;
+	int eof;
+
+	total = 0;
+	eof = 0;
+	for (;;) {
+		if (os->next == os->count) {
+			if (uevent_recv(os, nonblock) < 0)
+				return (total > 0 ? total : -1);
+			if (os->count == 0)
+				return (total);
+		}
+
+		while (os->next < os->count) {
+			m = &os->msgs[os->next];
+			if (m->msg_len == 0) {
+				eof = 1;
+				os->next++;
+				continue;
+			}
+			if ((m->msg_hdr.msg_flags & MSG_TRUNC) ||
+			    !uevent_from_kernel(&m->msg_hdr)) {
+				os->next++;
+				continue;
+			}
+
+			n = uevent_line(os->bufs[os->next], m->msg_len,
+			    buf + total, len - total);
+			if (n < 0)
+				return (total);
+			total += n;
+			os->next++;
+		}
+
+		if (total > 0 || eof)
+			return (total);
+
+		/* Only messages dropped, wait for more */
+		if (nonblock) {
+			errno = EAGAIN;
+			return (-1);
+		}
+	}
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2014 Baptiste Daroussin <bapt@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check the DRM queries against the fixture backend, with the PCI bus
+ * readable and not, so that the answers come from both paths.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libdevq.h>
+
+#include "devq_private.h"
+#include "fixture.h"
+
+static int failures;
+
+#define	CHECK(cond, dev) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: device %d: %s\n",		\
+		    __FILE__, __LINE__, (dev), #cond);			\
+		failures++;						\
+	}								\
+} while (0)
+
+static const char *
+expected_driver(int dev)
+{
+
+	return (dev % 2 ? "amdgpu" : "i915");
+}
+
+static void
+check_device(int dev, int pci)
+{
+	struct devq_drm_info info;
+	char buf[DEVQ_DEVNAME_MAX], path[32];
+	size_t len;
+	int fd, ret;
+	int domain, bus, slot, function;
+	int vendor_id, device_id, subvendor_id, subdevice_id, revision_id;
+
+	fd = fixture_fd(dev);
+	snprintf(path, sizeof(path), "/dev/dri/card%d", dev);
+
+	len = sizeof(buf);
+	ret = devq_device_get_devpath_from_fd(fd, buf, &len);
+	CHECK(ret == 0, dev);
+	CHECK(len == strlen(path) && memcmp(buf, path, len) == 0, dev);
+
+	len = sizeof(buf);
+	ret = devq_device_drm_get_drvname_from_fd(fd, buf, &len);
+	CHECK(ret == dev, dev);
+	CHECK(len == strlen(expected_driver(dev)) &&
+	    memcmp(buf, expected_driver(dev), len) == 0, dev);
+
+	len = 1;
+	ret = devq_device_drm_get_drvname_from_fd(fd, buf, &len);
+	CHECK(ret == -1 && errno == ENOMEM, dev);
+	CHECK(len == strlen(expected_driver(dev)), dev);
+
+	ret = devq_device_get_pcibusaddr(fd, &domain, &bus, &slot,
+	    &function);
+	CHECK(ret == 0, dev);
+	CHECK(domain == 0 && bus == dev + 1 && slot == 0 && function == 0,
+	    dev);
+
+	/* Only the revision needs the PCI bus */
+	ret = devq_device_get_pciid_full_from_fd(fd, &vendor_id, &device_id,
+	    &subvendor_id, &subdevice_id, &revision_id);
+	CHECK(ret == 0, dev);
+	CHECK(vendor_id == (dev % 2 ? 0x1002 : 0x8086), dev);
+	CHECK(device_id == 0x1000 + dev, dev);
+	CHECK(subvendor_id == vendor_id, dev);
+	CHECK(subdevice_id == 0x2000 + dev, dev);
+	CHECK(revision_id == (pci ? 0xc0 + dev % 16 : 0), dev);
+
+	vendor_id = device_id = -1;
+	ret = devq_device_get_pciid_from_fd(fd, &vendor_id, &device_id);
+	CHECK(ret == 0, dev);
+	CHECK(vendor_id == (dev % 2 ? 0x1002 : 0x8086), dev);
+	CHECK(device_id == 0x1000 + dev, dev);
+
+	ret = devq_device_drm_get_info(fd, &info);
+	CHECK(ret == 0, dev);
+	CHECK(info.valid == (DEVQ_DRM_INFO_PATH | DEVQ_DRM_INFO_BUSADDR |
+	    DEVQ_DRM_INFO_PCIID), dev);
+	CHECK(info.dri == dev, dev);
+	CHECK(strcmp(info.path, path) == 0, dev);
+	CHECK(strcmp(info.driver, expected_driver(dev)) == 0, dev);
+	CHECK(info.domain == 0 && info.bus == dev + 1 && info.slot == 0 &&
+	    info.function == 0, dev);
+	CHECK(info.vendor_id == vendor_id && info.device_id == device_id &&
+	    info.subvendor_id == subvendor_id &&
+	    info.subdevice_id == subdevice_id &&
+	    info.revision_id == revision_id, dev);
+}
+
+/* All the devices at once, with a descriptor that is not one of them */
+static void
+check_devpaths(int ndevs)
+{
+	char *paths, *p, path[32];
+	size_t len;
+	int *fds, dev, ret;
+
+	fds = calloc(ndevs + 1, sizeof(*fds));
+	if (fds == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	for (dev = 0; dev < ndevs; dev++)
+		fds[ndevs - 1 - dev] = fixture_fd(dev);
+	fds[ndevs] = -1;
+
+	ret = devq_device_get_devpaths_from_fds(fds, ndevs + 1, &paths,
+	    &len);
+	CHECK(ret == ndevs, -1);
+	if (ret == ndevs) {
+		p = paths;
+		for (dev = ndevs - 1; dev >= 0; dev--) {
+			snprintf(path, sizeof(path), "/dev/dri/card%d", dev);
+			CHECK(strcmp(p, path) == 0, dev);
+			p += strlen(p) + 1;
+		}
+		CHECK(*p == '\0', -1);
+		CHECK(len == (size_t)(p + 1 - paths), -1);
+		free(paths);
+	}
+
+	free(fds);
+}
+
+static void
+check_topology(int ndevs, int pci)
+{
+	int dev, ret;
+
+	fixture_setup(ndevs, 0, pci);
+
+	for (dev = 0; dev < ndevs; dev++)
+		check_device(dev, pci);
+	check_devpaths(ndevs);
+
+	/* The same answers once the topology is read again */
+	_devq_drm_invalidate();
+	for (dev = ndevs - 1; dev >= 0; dev--)
+		check_device(dev, pci);
+
+	ret = devq_device_get_pcibusaddr(fixture_fd(ndevs), &dev, &dev,
+	    &dev, &dev);
+	CHECK(ret == -1, ndevs);
+
+	/*
+	 * The devices come back unseen by any monitor: the unknown device
+	 * numbers have the topology read again, without the MIBs of the
+	 * devices that went away.
+	 */
+	fixture_replug();
+	for (dev = 0; dev < ndevs; dev++)
+		check_device(dev, pci);
+}
+
+int
+main(void)
+{
+	static const int ndevs[] = { 1, 4, 40 };
+	size_t i;
+
+	for (i = 0; i < sizeof(ndevs) / sizeof(ndevs[0]); i++) {
+		check_topology(ndevs[i], 1);
+		check_topology(ndevs[i], 0);
+	}
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return (EXIT_FAILURE);
+	}
+
+	return (EXIT_SUCCESS);
+}
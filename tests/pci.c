@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2014 Baptiste Daroussin <bapt@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check the PCI bus listing of the FreeBSD backend against a getconf
+ * that answers as the kernel does to PCIOCGETCONF: matching on class,
+ * a page of matches per call, and a changed list once the generation
+ * moves on.
+ */
+
+#include <sys/types.h>
+#include <sys/pciio.h>
+
+#include <dev/pci/pcireg.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "devq_private.h"
+
+#define	NFUNCS		120	/* on the bus */
+#define	NDISPLAY	(NFUNCS / 2)
+
+static int failures;
+
+#define	CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__,	\
+		    #cond);						\
+		failures++;						\
+	}								\
+} while (0)
+
+struct bus {
+	struct pci_conf	funcs[NFUNCS];
+	u_int		generation;
+	int		calls;
+	int		change_at;	/* call bumping generation, or -1 */
+	int		change_every;	/* bump it on every call */
+};
+
+/* Every other function is a display, the others network controllers */
+static void
+bus_init(struct bus *bus)
+{
+	struct pci_conf *p;
+	int i;
+
+	memset(bus, 0, sizeof(*bus));
+	bus->generation = 1;
+	bus->change_at = -1;
+	for (i = 0; i < NFUNCS; i++) {
+		p = &bus->funcs[i];
+		p->pc_sel.pc_bus = i / 8;
+		p->pc_sel.pc_dev = i % 8;
+		p->pc_class = i % 2 ? PCIC_NETWORK : PCIC_DISPLAY;
+		p->pc_vendor = 0x8086;
+		p->pc_device = 0x1000 + i;
+		p->pc_subvendor = 0x8086;
+		p->pc_subdevice = 0x2000 + i;
+		p->pc_revid = i % 256;
+	}
+}
+
+static int
+bus_match(const struct pci_conf_io *pc, const struct pci_conf *p)
+{
+	const struct pci_match_conf *m;
+	u_int i;
+
+	for (i = 0; i < pc->num_patterns; i++) {
+		m = &pc->patterns[i];
+		if ((m->flags & PCI_GETCONF_MATCH_CLASS) &&
+		    m->pc_class != p->pc_class)
+			continue;
+		return (1);
+	}
+
+	return (pc->num_patterns == 0);
+}
+
+/* As pci_ioctl() of sys/dev/pci/pci_user.c answers PCIOCGETCONF */
+static int
+bus_getconf(void *arg, struct pci_conf_io *pc)
+{
+	struct bus *bus = arg;
+	u_int i, max;
+
+	if (bus->change_every || bus->calls == bus->change_at)
+		bus->generation++;
+	bus->calls++;
+
+	if (pc->offset != 0 && pc->generation != bus->generation) {
+		pc->status = PCI_GETCONF_LIST_CHANGED;
+		pc->num_matches = 0;
+		return (0);
+	}
+	if (pc->pat_buf_len != pc->num_patterns * sizeof(*pc->patterns)) {
+		pc->status = PCI_GETCONF_ERROR;
+		return (0);
+	}
+
+	max = pc->match_buf_len / sizeof(struct pci_conf);
+	pc->num_matches = 0;
+	for (i = pc->offset; i < NFUNCS && pc->num_matches < max; i++) {
+		if (bus_match(pc, &bus->funcs[i]))
+			pc->matches[pc->num_matches++] = bus->funcs[i];
+	}
+	pc->offset = i;
+	pc->generation = bus->generation;
+	pc->status = i < NFUNCS ? PCI_GETCONF_MORE_DEVS :
+	    PCI_GETCONF_LAST_DEVICE;
+
+	return (0);
+}
+
+static void
+check_funcs(const struct devq_pci_func *funcs, size_t n)
+{
+	const struct devq_pci_func *f;
+	size_t i;
+	int dev;
+
+	for (i = 0; i < n; i++) {
+		f = &funcs[i];
+		dev = 2 * i;
+		CHECK(f->domain == 0 && f->bus == dev / 8 &&
+		    f->slot == dev % 8 && f->function == 0);
+		CHECK(f->vendor_id == 0x8086 && f->device_id == 0x1000 + dev);
+		CHECK(f->subvendor_id == 0x8086 &&
+		    f->subdevice_id == 0x2000 + dev);
+		CHECK(f->revision_id == dev % 256);
+	}
+}
+
+int
+main(void)
+{
+	struct devq_pci_func funcs[NFUNCS];
+	struct bus bus;
+	size_t n;
+
+	/* Only the displays, over several pages */
+	bus_init(&bus);
+	n = NFUNCS;
+	CHECK(_devq_pci_getconf_funcs(bus_getconf, &bus, funcs, &n) == 0);
+	CHECK(n == NDISPLAY);
+	CHECK(bus.calls > 1);
+	check_funcs(funcs, n);
+
+	/* The total, when there is less room than functions */
+	bus_init(&bus);
+	n = 3;
+	memset(funcs, 0xff, sizeof(funcs));
+	CHECK(_devq_pci_getconf_funcs(bus_getconf, &bus, funcs, &n) == 0);
+	CHECK(n == NDISPLAY);
+	check_funcs(funcs, 3);
+	CHECK(funcs[3].bus == -1);
+
+	/* Read again from the start once the list changes */
+	bus_init(&bus);
+	bus.change_at = 1;
+	n = NFUNCS;
+	CHECK(_devq_pci_getconf_funcs(bus_getconf, &bus, funcs, &n) == 0);
+	CHECK(n == NDISPLAY);
+	check_funcs(funcs, n);
+
+	/* Until it gives up, with a bus that never settles */
+	bus_init(&bus);
+	bus.change_every = 1;
+	n = NFUNCS;
+	errno = 0;
+	CHECK(_devq_pci_getconf_funcs(bus_getconf, &bus, funcs, &n) == -1);
+	CHECK(errno == EAGAIN);
+	CHECK(bus.calls == 2 * (DEVQ_PCI_RETRIES + 1));
+	CHECK(n == NFUNCS);
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return (EXIT_FAILURE);
+	}
+
+	return (EXIT_SUCCESS);
+}
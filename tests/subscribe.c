@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2014 Baptiste Daroussin <bapt@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check a monitor shared by subscribers while its filters and flags
+ * change under the thread reading it, uevents being written to one end
+ * of a socketpair(2) given to devq_event_monitor_init_fd(), and which
+ * flags it refuses once shared.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libdevq.h>
+
+#define	NEVENTS		2000	/* attached and detached in turn */
+
+static int failures;
+
+#define	CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__,	\
+		    #cond);						\
+		failures++;						\
+	}								\
+} while (0)
+
+static void *
+writer_main(void *arg)
+{
+	char msg[256];
+	const char *action;
+	int fd = *(int *)arg;
+	int i, len;
+
+	for (i = 0; i < NEVENTS; i++) {
+		action = i % 2 ? "remove" : "add";
+		len = snprintf(msg, sizeof(msg),
+		    "%s@/devices/virtual/input/input%d/event%d%c"
+		    "ACTION=%s%c"
+		    "DEVPATH=/devices/virtual/input/input%d/event%d%c"
+		    "SUBSYSTEM=input%c"
+		    "DEVNAME=input/event%d",
+		    action, i / 2, i / 2, '\0', action, '\0', i / 2, i / 2,
+		    '\0', '\0', i / 2);
+		if (send(fd, msg, len + 1, 0) != len + 1) {
+			perror("send");
+			exit(EXIT_FAILURE);
+		}
+	}
+	close(fd);
+
+	return (NULL);
+}
+
+/*
+ * The lookups of DEVQ_EVMON_ASYNC_IDS are only reported to the reader
+ * of the monitor, so it does not go with subscribers, in either order.
+ */
+static void
+check_async(void)
+{
+	struct devq_evmon *evm;
+	struct devq_evsub *sub;
+	int sv[2], flags;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) != 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+	if ((evm = devq_event_monitor_init_fd(sv[0])) == NULL) {
+		perror("devq_event_monitor_init_fd");
+		exit(EXIT_FAILURE);
+	}
+	flags = devq_event_monitor_get_flags(evm);
+
+	CHECK(devq_event_monitor_set_flags(evm,
+	    flags | DEVQ_EVMON_ASYNC_IDS) == 0);
+	CHECK(devq_event_monitor_subscribe(evm, 16) == NULL &&
+	    errno == EBUSY);
+
+	CHECK(devq_event_monitor_set_flags(evm, flags) == 0);
+	sub = devq_event_monitor_subscribe(evm, 16);
+	CHECK(sub != NULL);
+	CHECK(devq_event_monitor_set_flags(evm,
+	    flags | DEVQ_EVMON_ASYNC_IDS) == -1 && errno == EBUSY);
+	CHECK(devq_event_monitor_get_flags(evm) == flags);
+
+	close(sv[1]);
+	if (sub != NULL)
+		devq_event_unsubscribe(sub);
+	devq_event_monitor_fini(evm);
+}
+
+int
+main(void)
+{
+	struct devq_evmon *evm;
+	struct devq_evsub *sub;
+	struct devq_evmon_stats stats;
+	struct devq_event *e;
+	pthread_t writer;
+	int sv[2], attached, total, round, flags;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) != 0) {
+		perror("socketpair");
+		return (EXIT_FAILURE);
+	}
+	if ((evm = devq_event_monitor_init_fd(sv[0])) == NULL ||
+	    (sub = devq_event_monitor_subscribe(evm, NEVENTS)) == NULL) {
+		perror("devq_event_monitor");
+		return (EXIT_FAILURE);
+	}
+
+	/* The thread of the subscribers is the only one reading it */
+	CHECK(devq_event_monitor_poll_timeout(evm, 0) == -1 &&
+	    errno == EBUSY);
+	CHECK(devq_event_monitor_read(evm) == NULL && errno == EBUSY);
+
+	if ((errno = pthread_create(&writer, NULL, writer_main, &sv[1])) != 0) {
+		perror("pthread_create");
+		return (EXIT_FAILURE);
+	}
+
+	/*
+	 * Only the detached events may be filtered out, whenever the
+	 * filter happens to be there.
+	 */
+	attached = total = 0;
+	flags = devq_event_monitor_get_flags(evm);
+	for (round = 0;; round++) {
+		if (round % 2 == 0) {
+			CHECK(devq_event_monitor_add_filter(evm, DEVQ_ATTACHED,
+			    0, NULL, NULL) == 0);
+		} else
+			devq_event_monitor_clear_filters(evm);
+		CHECK(devq_event_monitor_set_flags(evm,
+		    flags ^ (round % 3 ? DEVQ_EVMON_REGISTRY : 0)) == 0);
+		CHECK(devq_event_monitor_get_stats(evm, &stats) == 0);
+
+		while ((e = devq_event_subscriber_read(sub)) != NULL) {
+			if (devq_event_get_type(e) == DEVQ_ATTACHED)
+				attached++;
+			total++;
+			devq_event_free(e);
+		}
+		if (errno != EAGAIN)
+			break;
+		devq_event_subscriber_poll(sub, 1);
+	}
+	CHECK(errno == 0);
+
+	CHECK(attached == NEVENTS / 2);
+	CHECK(total >= NEVENTS / 2 && total <= NEVENTS);
+	CHECK(devq_event_subscriber_get_stats(sub, &stats) == 0);
+	CHECK(stats.dropped == 0);
+	CHECK(devq_event_monitor_get_stats(evm, &stats) == 0);
+	CHECK(stats.filtered == (unsigned long)(NEVENTS - total));
+
+	pthread_join(writer, NULL);
+	devq_event_unsubscribe(sub);
+	devq_event_monitor_fini(evm);
+
+	check_async();
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return (EXIT_FAILURE);
+	}
+
+	return (EXIT_SUCCESS);
+}
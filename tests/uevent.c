@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2014 Baptiste Daroussin <bapt@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check the translation of Linux uevents into events: uevents written
+ * to one end of a socketpair(2) given to devq_event_monitor_init_fd(),
+ * and, for the check of the sender, to a netlink socket.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libdevq.h>
+
+static int failures;
+
+#define	CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__,	\
+		    #cond);						\
+		failures++;						\
+	}								\
+} while (0)
+
+static const char usb_add[] =
+    "add@/devices/pci0000:00/0000:00:14.0/usb1/1-1\0"
+    "ACTION=add\0"
+    "DEVPATH=/devices/pci0000:00/0000:00:14.0/usb1/1-1\0"
+    "SUBSYSTEM=usb\0"
+    "DEVTYPE=usb_device\0"
+    "DEVNAME=bus/usb/001/002\0"
+    "PRODUCT=46d/c077/7200";
+
+static const char pci_remove[] =
+    "remove@/devices/pci0000:00/0000:00:02.0\0"
+    "ACTION=remove\0"
+    "DEVPATH=/devices/pci0000:00/0000:00:02.0\0"
+    "SUBSYSTEM=pci\0"
+    "DRIVER=i915\0"
+    "PCI_ID=8086:1234";
+
+static const char drm_change[] =
+    "change@/devices/pci0000:00/0000:00:02.0/drm/card0\0"
+    "ACTION=change\0"
+    "DEVPATH=/devices/pci0000:00/0000:00:02.0/drm/card0\0"
+    "SUBSYSTEM=drm\0"
+    "DEVNAME=dri/card0\0"
+    "HOTPLUG=1";
+
+/* As libudev forwards them, with no "action@devpath" first */
+static const char no_header[] =
+    "libudev\0"
+    "ACTION=add\0"
+    "DEVPATH=/devices/virtual/input/input9\0"
+    "SUBSYSTEM=input";
+
+static void
+send_msg(int fd, const void *msg, size_t len)
+{
+
+	if (send(fd, msg, len, 0) != (ssize_t)len) {
+		perror("send");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* A mouse on USB, then one of the same IDs on the PS/2 port */
+static const char input_add[] =
+    "add@/devices/pci0000:00/0000:00:14.0/usb1/1-1/1-1:1.0/input/input5/event3\0"
+    "ACTION=add\0"
+    "DEVPATH=/devices/pci0000:00/0000:00:14.0/usb1/1-1/1-1:1.0/input/input5/event3\0"
+    "SUBSYSTEM=input\0"
+    "DEVNAME=input/event3\0"
+    "PRODUCT=3/46d/c077/111";
+
+static const char ps2_add[] =
+    "add@/devices/platform/i8042/serio1/input/input6/event4\0"
+    "ACTION=add\0"
+    "DEVPATH=/devices/platform/i8042/serio1/input/input6/event4\0"
+    "SUBSYSTEM=input\0"
+    "DEVNAME=input/event4\0"
+    "PRODUCT=11/8086/1234/ab41";
+
+/*
+ * The vendor and product IDs of the device of e, and their names in
+ * tests/usb.ids or tests/pci.ids, NULL for none.
+ */
+static void
+check_ids(struct devq_event *e, const char *vendor, const char *product,
+    const char *vendor_name, const char *product_name)
+{
+	struct devq_device *d;
+	const char *s;
+	size_t len;
+
+	d = devq_event_get_device(e);
+	CHECK(d != NULL);
+	if (d == NULL)
+		return;
+
+	s = devq_device_get_vendor_id(d, &len);
+	CHECK(s != NULL && len == strlen(vendor) &&
+	    memcmp(s, vendor, len) == 0);
+	s = devq_device_get_product_id(d, &len);
+	CHECK(s != NULL && len == strlen(product) &&
+	    memcmp(s, product, len) == 0);
+
+	s = devq_device_get_vendor(d);
+	CHECK(vendor_name != NULL ? s != NULL && strcmp(s, vendor_name) == 0 :
+	    s == NULL);
+	s = devq_device_get_product(d);
+	CHECK(product_name != NULL ?
+	    s != NULL && strcmp(s, product_name) == 0 : s == NULL);
+}
+
+static void
+check_socketpair(void)
+{
+	struct devq_evmon *evm;
+	struct devq_event *e;
+	const char *s;
+	char *big;
+	size_t big_len;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) != 0) {
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+	if ((evm = devq_event_monitor_init_fd(sv[0])) == NULL) {
+		perror("devq_event_monitor_init_fd");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 * Above what the monitor reads of a message: truncated, to what
+	 * would pass for a whole uevent but for the truncation.
+	 */
+	big_len = 8192;
+	if ((big = malloc(big_len)) == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memset(big, 'x', big_len);
+	memcpy(big, usb_add, sizeof(usb_add));
+	memcpy(big + sizeof(usb_add), "PAD=", 4);
+	big[4095] = '\0';
+	big[big_len - 1] = '\0';
+
+	send_msg(sv[1], usb_add, sizeof(usb_add));
+	send_msg(sv[1], no_header, sizeof(no_header));
+	send_msg(sv[1], big, big_len);
+	/* Cut short of its final NUL */
+	send_msg(sv[1], usb_add, sizeof(usb_add) - 1);
+	send_msg(sv[1], pci_remove, sizeof(pci_remove));
+	send_msg(sv[1], drm_change, sizeof(drm_change));
+	send_msg(sv[1], input_add, sizeof(input_add));
+	send_msg(sv[1], ps2_add, sizeof(ps2_add));
+	close(sv[1]);
+	free(big);
+
+	e = devq_event_monitor_read(evm);
+	CHECK(e != NULL);
+	if (e != NULL) {
+		CHECK(devq_event_get_type(e) == DEVQ_ATTACHED);
+		s = devq_event_get_attr(e, "devname");
+		CHECK(s != NULL && strcmp(s, "bus/usb/001/002") == 0);
+		check_ids(e, "0x046d", "0xc077", "Logitech, Inc.",
+		    "M105 Optical Mouse");
+		devq_event_free(e);
+	}
+
+	e = devq_event_monitor_read(evm);
+	CHECK(e != NULL);
+	if (e != NULL) {
+		CHECK(devq_event_get_type(e) == DEVQ_DETACHED);
+		s = devq_event_get_attr(e, "driver");
+		CHECK(s != NULL && strcmp(s, "i915") == 0);
+		check_ids(e, "0x8086", "0x1234", "Intel Corporation",
+		    "Test Graphics");
+		devq_event_free(e);
+	}
+
+	e = devq_event_monitor_read(evm);
+	CHECK(e != NULL);
+	if (e != NULL) {
+		CHECK(devq_event_get_type(e) == DEVQ_NOTICE);
+		s = devq_event_get_attr(e, "system");
+		CHECK(s != NULL && strcmp(s, "drm") == 0);
+		s = devq_event_get_attr(e, "type");
+		CHECK(s != NULL && strcmp(s, "change") == 0);
+		s = devq_event_get_attr(e, "cdev");
+		CHECK(s != NULL && strcmp(s, "dri/card0") == 0);
+		devq_event_free(e);
+	}
+
+	/* Input devices are named after the bus of their PRODUCT */
+	e = devq_event_monitor_read(evm);
+	CHECK(e != NULL);
+	if (e != NULL) {
+		CHECK(devq_event_get_type(e) == DEVQ_ATTACHED);
+		s = devq_event_get_attr(e, "id_bus");
+		CHECK(s != NULL && strcmp(s, "usb") == 0);
+		check_ids(e, "0x046d", "0xc077", "Logitech, Inc.",
+		    "M105 Optical Mouse");
+		devq_event_free(e);
+	}
+
+	e = devq_event_monitor_read(evm);
+	CHECK(e != NULL);
+	if (e != NULL) {
+		s = devq_event_get_attr(e, "id_bus");
+		CHECK(s != NULL && strcmp(s, "0x0011") == 0);
+		check_ids(e, "0x8086", "0x1234", NULL, NULL);
+		devq_event_free(e);
+	}
+
+	/* Then the end of the stream, and nothing of what was dropped */
+	errno = EINVAL;
+	e = devq_event_monitor_read(evm);
+	CHECK(e == NULL && errno == 0);
+
+	devq_event_monitor_fini(evm);
+}
+
+/*
+ * A uevent unicast by another process on a netlink socket is not from
+ * the kernel, and is dropped without ending the stream.
+ */
+static void
+check_sender(void)
+{
+	struct sockaddr_nl addr;
+	struct devq_evmon *evm;
+	struct devq_event *e;
+	socklen_t addr_len;
+	int fd, peer;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+	peer = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+	if (fd < 0 || peer < 0) {
+		fprintf(stderr, "no netlink socket, sender not checked\n");
+		if (fd >= 0)
+			close(fd);
+		if (peer >= 0)
+			close(peer);
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr_len = sizeof(addr);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    getsockname(fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+		perror("bind");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((evm = devq_event_monitor_init_fd(fd)) == NULL) {
+		perror("devq_event_monitor_init_fd");
+		exit(EXIT_FAILURE);
+	}
+	devq_event_monitor_set_flags(evm,
+	    devq_event_monitor_get_flags(evm) | DEVQ_EVMON_NONBLOCK);
+
+	if (sendto(peer, usb_add, sizeof(usb_add), 0,
+	    (struct sockaddr *)&addr, sizeof(addr)) != sizeof(usb_add)) {
+		perror("sendto");
+		exit(EXIT_FAILURE);
+	}
+
+	e = devq_event_monitor_read(evm);
+	CHECK(e == NULL && errno == EAGAIN);
+	if (e != NULL)
+		devq_event_free(e);
+
+	devq_event_monitor_fini(evm);
+	close(peer);
+}
+
+int
+main(void)
+{
+
+	check_socketpair();
+	check_sender();
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return (EXIT_FAILURE);
+	}
+
+	return (EXIT_SUCCESS);
+}
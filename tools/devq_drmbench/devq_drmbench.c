@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2014 Baptiste Daroussin <bapt@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure the DRM query functions against the fixture backend: how many
+ * backend calls, standing for system calls, and how much time each query
+ * takes, with the DRM topology cache warm and cold.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libdevq.h>
+
+#include "devq_private.h"
+#include "fixture.h"
+
+static int
+query_devpath(int fd)
+{
+	char path[DEVQ_DEVNAME_MAX];
+	size_t len;
+
+	len = sizeof(path);
+	return (devq_device_get_devpath_from_fd(fd, path, &len));
+}
+
+/* The paths of all the devices at once, whatever fd */
+static int *all_fds;
+static int nall_fds;
+
+static int
+query_devpaths(int fd)
+{
+	char *paths;
+	int ret;
+
+	(void)fd;
+	ret = devq_device_get_devpaths_from_fds(all_fds, nall_fds, &paths,
+	    NULL);
+	if (ret < 0)
+		return (-1);
+	free(paths);
+
+	return (ret == nall_fds ? 0 : -1);
+}
+
+static int
+query_drvname(int fd)
+{
+	char name[DEVQ_DEVNAME_MAX];
+	size_t len;
+
+	len = sizeof(name);
+	return (devq_device_drm_get_drvname_from_fd(fd, name, &len));
+}
+
+static int
+query_pcibusaddr(int fd)
+{
+	int domain, bus, slot, function;
+
+	return (devq_device_get_pcibusaddr(fd, &domain, &bus, &slot,
+	    &function));
+}
+
+static int
+query_pciid(int fd)
+{
+	int vendor_id, device_id;
+
+	return (devq_device_get_pciid_from_fd(fd, &vendor_id, &device_id));
+}
+
+static int
+query_pciid_full(int fd)
+{
+	int vendor_id, device_id, subvendor_id, subdevice_id, revision_id;
+
+	return (devq_device_get_pciid_full_from_fd(fd, &vendor_id,
+	    &device_id, &subvendor_id, &subdevice_id, &revision_id));
+}
+
+static int
+query_info(int fd)
+{
+	struct devq_drm_info info;
+
+	return (devq_device_drm_get_info(fd, &info));
+}
+
+static const struct {
+	const char	*name;
+	int		(*query)(int fd);
+} queries[] = {
+	{ "devq_device_get_devpath_from_fd",	query_devpath },
+	{ "devq_device_get_devpaths_from_fds",	query_devpaths },
+	{ "devq_device_drm_get_drvname_from_fd", query_drvname },
+	{ "devq_device_get_pcibusaddr",		query_pcibusaddr },
+	{ "devq_device_get_pciid_from_fd",	query_pciid },
+	{ "devq_device_get_pciid_full_from_fd",	query_pciid_full },
+	{ "devq_device_drm_get_info",		query_info },
+};
+
+#define NQUERIES	(sizeof(queries) / sizeof(queries[0]))
+
+/*
+ * Run a query iterations times, round-robin over the devices, and
+ * report the backend calls and nanoseconds per query. With cold, the
+ * DRM topology cache is invalidated before each query, as a devd event
+ * would.
+ *
+ * The time is the best of NPASSES: a single pass of a few milliseconds
+ * is easily stretched by the scheduler or a clock ramping up, which
+ * shows as a query being slower warm than cold.
+ */
+#define	NPASSES	5
+
+static void
+run(int (*query)(int), int ndevs, unsigned long iterations, int cold,
+    double *calls, double *ns)
+{
+	struct timespec start, stop;
+	unsigned long i, ncalls;
+	double pass_ns;
+	int pass;
+
+	/* Warm the cache up, and check the query works at all. */
+	if (query(fixture_fd(0)) < 0)
+		err(EXIT_FAILURE, "query failed");
+
+	for (pass = 0; pass < NPASSES; pass++) {
+		ncalls = fixture_calls();
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < iterations; i++) {
+			if (cold)
+				_devq_drm_invalidate();
+			if (query(fixture_fd(i % ndevs)) < 0)
+				err(EXIT_FAILURE, "query failed");
+		}
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+
+		pass_ns = ((stop.tv_sec - start.tv_sec) * 1e9 +
+		    (stop.tv_nsec - start.tv_nsec)) / iterations;
+		if (pass == 0 || pass_ns < *ns)
+			*ns = pass_ns;
+	}
+
+	*calls = (double)(fixture_calls() - ncalls) / iterations;
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: devq-drmbench [-P] [-n devices] [-l latency_ns] "
+	    "[-i iterations]\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned long iterations, latency;
+	double warm_calls, warm_ns, cold_calls, cold_ns;
+	size_t q;
+	int ch, ndevs, pci;
+
+	ndevs = 4;
+	latency = 0;
+	iterations = 10000;
+	pci = 1;
+
+	while ((ch = getopt(argc, argv, "Pi:l:n:")) != -1) {
+		switch (ch) {
+		case 'P':
+			pci = 0;
+			break;
+		case 'i':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			latency = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			ndevs = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (iterations == 0 || ndevs <= 0)
+		usage();
+
+	fixture_setup(ndevs, latency, pci);
+
+	if ((all_fds = calloc(ndevs, sizeof(*all_fds))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	for (nall_fds = 0; nall_fds < ndevs; nall_fds++)
+		all_fds[nall_fds] = fixture_fd(nall_fds);
+
+	printf("%d devices%s, %lu ns per call, %lu queries\n\n",
+	    ndevs, pci ? "" : " without /dev/pci", latency, iterations);
+	printf("%-38s %12s %12s %12s %12s\n", "",
+	    "calls/query", "ns/query", "calls/query", "ns/query");
+	printf("%-38s %25s %25s\n", "function", "(warm cache)",
+	    "(cold cache)");
+
+	for (q = 0; q < NQUERIES; q++) {
+		run(queries[q].query, ndevs, iterations, 0,
+		    &warm_calls, &warm_ns);
+		run(queries[q].query, ndevs, iterations, 1,
+		    &cold_calls, &cold_ns);
+		printf("%-38s %12.2f %12.0f %12.2f %12.0f\n", queries[q].name,
+		    warm_calls, warm_ns, cold_calls, cold_ns);
+	}
+
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2014 Baptiste Daroussin <bapt@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "devq_private.h"
+#include "fixture.h"
+
+#define	FIXTURE_RDEV(dev)	(0x80 + (dev) + 0x100 * fixture_plugs)
+
+static int fixture_ndevs;
+static int fixture_plugs;
+static int fixture_has_pci;
+static unsigned long fixture_latency;
+static unsigned long fixture_ncalls;
+
+/*
+ * Spin rather than sleep: sleeping has a granularity far above the
+ * cost of a system call.
+ */
+static void
+fixture_call(void)
+{
+	struct timespec start, now;
+	unsigned long elapsed;
+
+	fixture_ncalls++;
+	if (fixture_latency == 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000000000UL +
+		    now.tv_nsec - start.tv_nsec;
+	} while (elapsed < fixture_latency);
+}
+
+/*
+ * DRM device $n is on PCI bus $n + 1 and is found as vgapci device
+ * (ndevs - 1 - $n), so that matching them takes a search.
+ */
+static int
+fixture_value(const char *name, char *value, size_t size)
+{
+	int dev;
+	char leaf[32];
+
+	if (sscanf(name, "hw.dri.%d.%31s", &dev, leaf) == 2 &&
+	    dev >= 0 && dev < fixture_ndevs) {
+		if (strcmp(leaf, "name") == 0)
+			return (snprintf(value, size, "%s 0x%x",
+			    dev % 2 ? "amdgpu" : "i915", FIXTURE_RDEV(dev)));
+		if (strcmp(leaf, "busid") == 0)
+			return (snprintf(value, size, "pci:0000:%02x:00.0",
+			    dev + 1));
+		return (-1);
+	}
+
+	if (sscanf(name, "dev.vgapci.%d.%31s", &dev, leaf) == 2 &&
+	    dev >= 0 && dev < fixture_ndevs) {
+		dev = fixture_ndevs - 1 - dev;
+		if (strcmp(leaf, "%location") == 0)
+			return (snprintf(value, size,
+			    "pci0:%d:0:0 handle=\\_SB_.PCI0.PEG%d",
+			    dev + 1, dev));
+		if (strcmp(leaf, "%parent") == 0)
+			return (snprintf(value, size, "pci%d", dev + 1));
+		if (strcmp(leaf, "%pnpinfo") == 0)
+			return (snprintf(value, size,
+			    "vendor=0x%04x device=0x%04x subvendor=0x%04x "
+			    "subdevice=0x%04x class=0x030000",
+			    dev % 2 ? 0x1002 : 0x8086, 0x1000 + dev,
+			    dev % 2 ? 0x1002 : 0x8086, 0x2000 + dev));
+		return (-1);
+	}
+
+	return (-1);
+}
+
+static int
+fixture_read(const char *name, void *oldp, size_t *oldlenp,
+    const void *newp, size_t newlen)
+{
+	char value[256];
+	int len;
+
+	if (newp != NULL || newlen != 0) {
+		errno = EPERM;
+		return (-1);
+	}
+
+	len = fixture_value(name, value, sizeof(value));
+	if (len < 0) {
+		errno = ENOENT;
+		return (-1);
+	}
+	len++;
+
+	if (oldp != NULL) {
+		if (*oldlenp < (size_t)len) {
+			memcpy(oldp, value, *oldlenp);
+			errno = ENOMEM;
+			return (-1);
+		}
+		memcpy(oldp, value, len);
+	}
+	*oldlenp = len;
+
+	return (0);
+}
+
+static int
+fixture_sysctlbyname(const char *name, void *oldp, size_t *oldlenp,
+    const void *newp, size_t newlen)
+{
+
+	fixture_call();
+
+	return (fixture_read(name, oldp, oldlenp, newp, newlen));
+}
+
+/*
+ * A MIB is {FIXTURE_MIB, $i}, $i indexing the names resolved so far.
+ */
+#define	FIXTURE_MIB	0x4d4942
+#define	FIXTURE_MIB_MAX	1024
+
+static char *fixture_mib_names[FIXTURE_MIB_MAX];
+static int fixture_nmibs;
+
+/*
+ * Every device goes away and comes back with a new device number, and
+ * the hw.dri MIBs resolved before now name the next device: the kernel
+ * numbers a new node after the last one given out.
+ */
+void
+fixture_replug(void)
+{
+	char leaf[32], *name;
+	int i, dev;
+
+	fixture_plugs++;
+	for (i = 0; i < fixture_nmibs; i++) {
+		if (sscanf(fixture_mib_names[i], "hw.dri.%d.%31s", &dev,
+		    leaf) != 2 ||
+		    asprintf(&name, "hw.dri.%d.%s", (dev + 1) % fixture_ndevs,
+		    leaf) < 0)
+			continue;
+		free(fixture_mib_names[i]);
+		fixture_mib_names[i] = name;
+	}
+}
+
+static int
+fixture_sysctlnametomib(const char *name, int *mibp, size_t *sizep)
+{
+	char value[256];
+	int i;
+
+	fixture_call();
+
+	if (fixture_value(name, value, sizeof(value)) < 0) {
+		errno = ENOENT;
+		return (-1);
+	}
+	if (*sizep < 2) {
+		errno = ENOMEM;
+		return (-1);
+	}
+
+	for (i = 0; i < fixture_nmibs; i++) {
+		if (strcmp(fixture_mib_names[i], name) == 0)
+			break;
+	}
+	if (i == fixture_nmibs) {
+		if (i == FIXTURE_MIB_MAX ||
+		    (fixture_mib_names[i] = strdup(name)) == NULL) {
+			errno = ENOMEM;
+			return (-1);
+		}
+		fixture_nmibs++;
+	}
+
+	mibp[0] = FIXTURE_MIB;
+	mibp[1] = i;
+	*sizep = 2;
+
+	return (0);
+}
+
+static int
+fixture_sysctl(const int *name, u_int namelen, void *oldp,
+    size_t *oldlenp, const void *newp, size_t newlen)
+{
+
+	fixture_call();
+
+	if (namelen != 2 || name[0] != FIXTURE_MIB || name[1] < 0 ||
+	    name[1] >= fixture_nmibs) {
+		errno = ENOENT;
+		return (-1);
+	}
+
+	return (fixture_read(fixture_mib_names[name[1]], oldp, oldlenp,
+	    newp, newlen));
+}
+
+static int
+fixture_fstat(int fd, struct stat *st)
+{
+
+	fixture_call();
+
+	if (fd < FIXTURE_FD_BASE || fd >= FIXTURE_FD_BASE + fixture_ndevs) {
+		errno = EBADF;
+		return (-1);
+	}
+
+	memset(st, 0, sizeof(*st));
+	st->st_mode = S_IFCHR | 0666;
+	st->st_rdev = FIXTURE_RDEV(fd - FIXTURE_FD_BASE);
+
+	return (0);
+}
+
+static int
+fixture_fd_path(int fd, char *path, size_t path_size)
+{
+
+	fixture_call();
+
+	if (fd < FIXTURE_FD_BASE || fd >= FIXTURE_FD_BASE + fixture_ndevs) {
+		errno = EBADF;
+		return (-1);
+	}
+
+	if ((size_t)snprintf(path, path_size, "/dev/dri/card%d",
+	    fd - FIXTURE_FD_BASE) >= path_size) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* A single call, as the file table is read once for all descriptors */
+static int
+fixture_fd_paths(const int *fds, size_t nfds,
+    void (*found)(void *arg, size_t i, const char *path), void *arg)
+{
+	char path[32];
+	size_t i;
+
+	fixture_call();
+
+	for (i = 0; i < nfds; i++) {
+		if (fds[i] < FIXTURE_FD_BASE ||
+		    fds[i] >= FIXTURE_FD_BASE + fixture_ndevs)
+			continue;
+		snprintf(path, sizeof(path), "/dev/dri/card%d",
+		    fds[i] - FIXTURE_FD_BASE);
+		found(arg, i, path);
+	}
+
+	return (0);
+}
+
+/*
+ * Both hw.dri and dev.vgapci have ndevs children. Each step costs a
+ * call for the next oid and one for its name, and the first one a call
+ * for the oid of the node, as the system does.
+ */
+static int
+fixture_sysctl_iter(struct devq_sysctl_iter *it, const char *name,
+    int *index)
+{
+
+	if (it->miblen == 0) {
+		fixture_call();
+		if (strcmp(name, "hw.dri") != 0 &&
+		    strcmp(name, "dev.vgapci") != 0) {
+			errno = ENOENT;
+			return (-1);
+		}
+		it->miblen = 1;
+		it->child = -1;
+	}
+
+	fixture_call();
+	if (it->child + 1 >= fixture_ndevs) {
+		errno = ENOENT;
+		return (-1);
+	}
+	fixture_call();
+
+	*index = ++it->child;
+
+	return (0);
+}
+
+/*
+ * The PCI bus, as a PCIOCGETCONF on /dev/pci would list it: one call
+ * for all the devices, with the IDs found in dev.vgapci and a revision.
+ */
+static int
+fixture_pci_funcs(struct devq_pci_func *funcs, size_t *nfuncs)
+{
+	struct devq_pci_func *f;
+	int dev;
+
+	fixture_call();
+
+	if (!fixture_has_pci) {
+		errno = EACCES;
+		return (-1);
+	}
+
+	for (dev = 0; dev < fixture_ndevs && (size_t)dev < *nfuncs; dev++) {
+		f = &funcs[dev];
+		f->domain = 0;
+		f->bus = dev + 1;
+		f->slot = 0;
+		f->function = 0;
+		f->vendor_id = dev % 2 ? 0x1002 : 0x8086;
+		f->device_id = 0x1000 + dev;
+		f->subvendor_id = f->vendor_id;
+		f->subdevice_id = 0x2000 + dev;
+		f->revision_id = 0xc0 + dev % 16;
+	}
+	*nfuncs = fixture_ndevs;
+
+	return (0);
+}
+
+static const struct devq_backend fixture_backend = {
+	.sysctlbyname	= fixture_sysctlbyname,
+	.sysctlnametomib = fixture_sysctlnametomib,
+	.sysctl		= fixture_sysctl,
+	.fstat		= fixture_fstat,
+	.fd_path	= fixture_fd_path,
+	.fd_paths	= fixture_fd_paths,
+	.sysctl_iter	= fixture_sysctl_iter,
+	.pci_funcs	= fixture_pci_funcs,
+};
+
+const struct devq_backend *_devq_backend = &fixture_backend;
+
+void
+fixture_setup(int ndevs, unsigned long latency_ns, int pci)
+{
+
+	fixture_ndevs = ndevs;
+	fixture_latency = latency_ns;
+	fixture_has_pci = pci;
+	_devq_drm_invalidate();
+}
+
+int
+fixture_fd(int dev)
+{
+
+	return (FIXTURE_FD_BASE + dev);
+}
+
+unsigned long
+fixture_calls(void)
+{
+
+	return (fixture_ncalls);
+}
@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2014 Baptiste Daroussin <bapt@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Feed synthetic devd lines, or kernel uevents on Linux, through a local
+ * Unix socket and measure how fast the event monitor turns them into
+ * events.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libdevq.h>
+
+#define BATCH_SIZE	64
+#define MAX_SUBS	64
+
+#if defined(__linux__)
+#define UEVENT(s)	{ s, sizeof(s) }
+
+/* The events fed, as the kernel sends them */
+static const struct {
+	const char	*msg;
+	size_t		len;
+} uevents[] = {
+	UEVENT("add@/devices/pci0000:00/0000:00:14.0/usb1/1-3\0"
+	    "ACTION=add\0DEVPATH=/devices/pci0000:00/0000:00:14.0/usb1/1-3\0"
+	    "SUBSYSTEM=usb\0MAJOR=189\0MINOR=1\0DEVNAME=bus/usb/001/002\0"
+	    "DEVTYPE=usb_device\0PRODUCT=46d/c31c/6400\0TYPE=0/0/0\0"
+	    "BUSNUM=001\0DEVNUM=002\0SEQNUM=2211"),
+	UEVENT("add@/devices/virtual/input/input7/mouse0\0"
+	    "ACTION=add\0DEVPATH=/devices/virtual/input/input7/mouse0\0"
+	    "SUBSYSTEM=input\0MAJOR=13\0MINOR=32\0DEVNAME=input/mouse0\0"
+	    "SEQNUM=2212"),
+	UEVENT("change@/devices/pci0000:00/0000:00:02.0/drm/card0\0"
+	    "ACTION=change\0DEVPATH=/devices/pci0000:00/0000:00:02.0/drm/card0\0"
+	    "SUBSYSTEM=drm\0HOTPLUG=1\0DEVNAME=dri/card0\0"
+	    "DEVTYPE=drm_minor\0SEQNUM=2213\0MAJOR=226\0MINOR=0"),
+	UEVENT("remove@/devices/virtual/input/input7/mouse0\0"
+	    "ACTION=remove\0DEVPATH=/devices/virtual/input/input7/mouse0\0"
+	    "SUBSYSTEM=input\0MAJOR=13\0MINOR=32\0DEVNAME=input/mouse0\0"
+	    "SEQNUM=2214"),
+};
+
+#define NUEVENTS	(sizeof(uevents) / sizeof(uevents[0]))
+
+/* One message per uevent, as on a netlink socket */
+static void
+feed(int fd, unsigned long count, unsigned long burst)
+{
+	unsigned long i;
+
+	(void)burst;
+	for (i = 0; i < count; i++) {
+		if (send(fd, uevents[i % NUEVENTS].msg,
+		    uevents[i % NUEVENTS].len, 0) < 0)
+			err(EXIT_FAILURE, "send");
+	}
+}
+
+#define SOCKET_TYPE	SOCK_SEQPACKET
+#else
+
+/* The events fed, as devd sends them */
+static const char *lines[] = {
+	"+ukbd0 at bus=0 sernum=\"\" on uhub0 intclass=0x03 intsubclass=0x01 "
+	    "intprotocol=0x01 vendor=0x046d product=0xc31c devclass=0x00 "
+	    "devsubclass=0x00 release=0x6400 mode=host port=3 devaddr=2",
+	"+ums0 at bus=0 sernum=\"\" on uhub0 intclass=0x03 intsubclass=0x01 "
+	    "intprotocol=0x02 vendor=0x046d product=0xc077 devclass=0x00 "
+	    "devsubclass=0x00 release=0x7200 mode=host port=4 devaddr=3",
+	"!system=USB subsystem=DEVICE type=ATTACH ugen=ugen0.2 cdev=ugen0.2 "
+	    "vendor=0x046d product=0xc31c devclass=0x00 devsubclass=0x00 "
+	    "sernum=\"\" release=0x6400 mode=host port=3 parent=uhub0",
+	"-ums0 at bus=0 sernum=\"\" on uhub0 intclass=0x03 intsubclass=0x01 "
+	    "intprotocol=0x02 vendor=0x046d product=0xc077 devclass=0x00 "
+	    "devsubclass=0x00 release=0x7200 mode=host port=4 devaddr=3",
+};
+
+#define NLINES		(sizeof(lines) / sizeof(lines[0]))
+
+static void
+feed(int fd, unsigned long count, unsigned long burst)
+{
+	char *buf;
+	size_t len, cap;
+	unsigned long i, j;
+
+	cap = 4096 * burst;
+	if ((buf = malloc(cap)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+
+	for (i = 0; i < count; i += burst) {
+		len = 0;
+		for (j = i; j < i + burst && j < count; j++)
+			len += snprintf(buf + len, cap - len, "%s\n",
+			    lines[j % NLINES]);
+		if (write(fd, buf, len) != (ssize_t)len)
+			err(EXIT_FAILURE, "write");
+	}
+
+	free(buf);
+}
+
+#define SOCKET_TYPE	SOCK_STREAM
+#endif
+
+struct subscriber {
+	pthread_t thread;
+	struct devq_evsub *sub;
+	unsigned long n;
+	bool device;
+};
+
+static void *
+subscriber_main(void *arg)
+{
+	struct subscriber *s = arg;
+	struct devq_event *ev;
+
+	while (devq_event_subscriber_poll(s->sub, -1) >= 0) {
+		while ((ev = devq_event_subscriber_read(s->sub)) != NULL) {
+			s->n++;
+			if (s->device)
+				devq_event_get_device(ev);
+			devq_event_free(ev);
+		}
+		if (errno != EAGAIN)
+			break;
+	}
+
+	return (NULL);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: devq-evbench [-Bdr] [-n events] [-b burst] "
+	    "[-s subscribers]\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct devq_evmon *evm;
+	struct devq_event *ev, *evs[BATCH_SIZE];
+	struct devq_evmon_stats stats, substats;
+	struct timespec start, stop;
+	struct subscriber subs[MAX_SUBS];
+	struct pollfd pfd;
+	unsigned long count, burst, n, nsubs, waits;
+	double elapsed;
+	bool batch, device, raw;
+	pid_t pid;
+	int ch, go[2], i, ret, sv[2];
+
+	count = 100000;
+	burst = 64;
+	batch = false;
+	device = false;
+	raw = false;
+	nsubs = 0;
+
+	while ((ch = getopt(argc, argv, "Bb:dn:rs:")) != -1) {
+		switch (ch) {
+		case 'B':
+			batch = true;
+			break;
+		case 'd':
+			device = true;
+			break;
+		case 'b':
+			burst = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			raw = true;
+			break;
+		case 's':
+			nsubs = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (count == 0 || burst == 0 || nsubs > MAX_SUBS)
+		usage();
+
+	if (socketpair(AF_UNIX, SOCKET_TYPE, 0, sv) < 0)
+		err(EXIT_FAILURE, "socketpair");
+	if (pipe(go) < 0)
+		err(EXIT_FAILURE, "pipe");
+
+	if ((pid = fork()) < 0)
+		err(EXIT_FAILURE, "fork");
+
+	if (pid == 0) {
+		close(sv[0]);
+		close(go[1]);
+		/* Wait for everyone to subscribe */
+		if (read(go[0], &ch, 1) < 0)
+			err(EXIT_FAILURE, "read");
+		feed(sv[1], count, burst);
+		close(sv[1]);
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(sv[1]);
+	if ((evm = devq_event_monitor_init_fd(sv[0])) == NULL)
+		err(EXIT_FAILURE, "devq_event_monitor_init_fd");
+
+	/* Rings deep enough for the subscribers to never lose an event */
+	for (i = 0; i < (int)nsubs; i++) {
+		subs[i].sub = devq_event_monitor_subscribe(evm, count);
+		if (subs[i].sub == NULL)
+			err(EXIT_FAILURE, "devq_event_monitor_subscribe");
+		subs[i].n = 0;
+		subs[i].device = device;
+	}
+	close(go[0]);
+	close(go[1]);
+
+	n = 0;
+	waits = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (nsubs > 0) {
+		for (i = 0; i < (int)nsubs; i++)
+			pthread_create(&subs[i].thread, NULL, subscriber_main,
+			    &subs[i]);
+		n = count;
+		for (i = 0; i < (int)nsubs; i++) {
+			pthread_join(subs[i].thread, NULL);
+			if (subs[i].n < n)
+				n = subs[i].n;
+		}
+	}
+	if (raw) {
+		/* Wait on the socket as an event loop would, then drain it */
+		devq_event_monitor_set_flags(evm, DEVQ_EVMON_RAWFD);
+		pfd.fd = devq_event_monitor_get_fd(evm);
+		pfd.events = POLLIN;
+		while (n < count) {
+			waits++;
+			if (poll(&pfd, 1, -1) < 0)
+				err(EXIT_FAILURE, "poll");
+			while ((ev = devq_event_monitor_read(evm)) != NULL) {
+				n++;
+				if (device)
+					devq_event_get_device(ev);
+				devq_event_free(ev);
+			}
+			if (errno != EAGAIN)
+				break;
+		}
+	}
+	while (!raw && nsubs == 0 && n < count &&
+	    devq_event_monitor_poll(evm)) {
+		if (batch) {
+			ret = devq_event_monitor_read_batch(evm, evs,
+			    BATCH_SIZE);
+			if (ret < 0)
+				break;
+			for (i = 0; i < ret; i++) {
+				if (device)
+					devq_event_get_device(evs[i]);
+				devq_event_free(evs[i]);
+			}
+			n += ret;
+			continue;
+		}
+
+		ev = devq_event_monitor_read(evm);
+		if (ev == NULL)
+			break;
+		n++;
+		if (device)
+			devq_event_get_device(ev);
+		devq_event_free(ev);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	devq_event_monitor_get_stats(evm, &stats);
+	stats.polls += waits;
+	for (i = 0; i < (int)nsubs; i++) {
+		devq_event_subscriber_get_stats(subs[i].sub, &substats);
+		stats.polls += substats.polls;
+		stats.dropped += substats.dropped;
+		devq_event_unsubscribe(subs[i].sub);
+	}
+	devq_event_monitor_fini(evm);
+	waitpid(pid, NULL, 0);
+
+	if (n == 0)
+		errx(EXIT_FAILURE, "no events received");
+
+	elapsed = (stop.tv_sec - start.tv_sec) +
+	    (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+	if (nsubs > 0) {
+		printf("subscribers:      %lu\n", nsubs);
+		printf("events dropped:   %lu\n", stats.dropped);
+	}
+	printf("events:           %lu\n", n);
+	printf("events/sec:       %.0f\n", n / elapsed);
+	printf("socket reads:     %lu\n", stats.reads);
+	printf("poll waits:       %lu\n", stats.polls);
+	printf("syscalls/event:   %.3f\n",
+	    (double)(stats.reads + stats.polls) / n);
+	printf("allocations:      %lu\n", stats.allocs);
+	printf("allocs/event:     %.3f\n", (double)stats.allocs / n);
+
+	return (EXIT_SUCCESS);
+}
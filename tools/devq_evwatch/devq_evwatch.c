@@ -25,6 +25,8 @@
  */
 
 #include <sys/types.h>
+#include <err.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -32,90 +34,106 @@
 
 #include <libdevq.h>
 
+static const char *
+device_kind(struct devq_device *dev)
+{
+
+	switch (devq_device_get_type(dev)) {
+	case DEVQ_DEVICE_JOYSTICK:
+		return ("Joystick");
+	case DEVQ_DEVICE_TOUCHSCREEN:
+		return ("Touchscreen");
+	case DEVQ_DEVICE_TOUCHPAD:
+		return ("Touchpad");
+	case DEVQ_DEVICE_KEYBOARD:
+		return ("Keyboard");
+	case DEVQ_DEVICE_MOUSE:
+		return ("Mouse");
+	default:
+		return ("Unknown device");
+	}
+}
+
+static void
+on_attach(struct devq_event *ev, void *ctx)
+{
+	struct devq_device *dev;
+	const char *vendor, *product;
+
+	(void)ctx;
+	dev = devq_event_get_device(ev);
+	printf("%s attached\n", device_kind(dev));
+	vendor = devq_device_get_vendor(dev);
+	product = devq_device_get_product(dev);
+	printf("Device path: %s; vendor: %s; product: %s\n",
+	    devq_device_get_path(dev),
+	    vendor ? vendor : "unknown",
+	    product ? product : "unknown");
+}
+
+static void
+on_detach(struct devq_event *ev, void *ctx)
+{
+	struct devq_device *dev;
+
+	(void)ctx;
+	dev = devq_event_get_device(ev);
+	printf("%s detached\n", device_kind(dev));
+	printf("Device path: %s\n", devq_device_get_path(dev));
+}
+
+static void
+on_other(struct devq_event *ev, void *ctx)
+{
+
+	(void)ev;
+	printf("%s\n", (const char *)ctx);
+}
+
+static void
+on_any(struct devq_event *ev, void *ctx)
+{
+
+	(void)ctx;
+	printf("%s\n", devq_event_dump(ev));
+}
+
 int
 main(int argc, char **argv)
 {
 	struct devq_evmon *e;
-	struct devq_event *ev;
-	struct devq_device *dev;
-	const char *vendor, *product;
 	bool verbose = false;
 
 	if (argc == 2 && strcmp(argv[1], "-v") == 0)
 		verbose = true;
 
 	e = devq_event_monitor_init();
+	if (e == NULL)
+		err(EXIT_FAILURE, "devq_event_monitor_init");
 
-	while (devq_event_monitor_poll(e)) {
-		ev = devq_event_monitor_read(e);
-		if (ev == NULL)
-			break;
+	devq_event_monitor_on(e, DEVQ_ATTACHED, 0, on_attach, NULL);
+	devq_event_monitor_on(e, DEVQ_DETACHED, 0, on_detach, NULL);
+	devq_event_monitor_on(e, DEVQ_NOTICE, 0, on_other,
+	    "Notice received");
+	devq_event_monitor_on(e, DEVQ_UNKNOWN, 0, on_other, "Unknown event");
+	if (verbose)
+		devq_event_monitor_on(e, 0, 0, on_any, NULL);
 
-		switch (devq_event_get_type(ev)) {
-		case DEVQ_ATTACHED:
-			dev = devq_event_get_device(ev);
-			switch (devq_device_get_type(dev)) {
-			case DEVQ_DEVICE_JOYSTICK:
-				printf("Joystick attached\n");
-				break;
-			case DEVQ_DEVICE_TOUCHSCREEN:
-				printf("Touchscreen attached\n");
-				break;
-			case DEVQ_DEVICE_TOUCHPAD:
-				printf("Touchpad attached\n");
-				break;
-			case DEVQ_DEVICE_KEYBOARD:
-				printf("Keyboard attached\n");
-				break;
-			case DEVQ_DEVICE_MOUSE:
-				printf("Mouse attached\n");
-				break;
-			case DEVQ_DEVICE_UNKNOWN:
-				printf("Unknown device attached\n");
-				break;
-			}
-			vendor = devq_device_get_vendor(dev);
-			product = devq_device_get_product(dev);
-			printf("Device path: %s; vendor: %s; product: %s\n",
-			    devq_device_get_path(dev),
-			    vendor ? vendor : "unknown",
-			    product ? product : "unknown");
+	/* Only the end of the stream (errno 0) or an error ends the loop */
+	for (;;) {
+		if (devq_event_monitor_poll_timeout(e, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			warn("devq_event_monitor_poll_timeout");
 			break;
-		case DEVQ_DETACHED:
-			dev = devq_event_get_device(ev);
-			switch (devq_device_get_type(dev)) {
-			case DEVQ_DEVICE_JOYSTICK:
-				printf("Joystick detached\n");
-				break;
-			case DEVQ_DEVICE_TOUCHSCREEN:
-				printf("Touchscreen detached\n");
-				break;
-			case DEVQ_DEVICE_TOUCHPAD:
-				printf("Touchpad detached\n");
-				break;
-			case DEVQ_DEVICE_KEYBOARD:
-				printf("Keyboard detached\n");
-				break;
-			case DEVQ_DEVICE_MOUSE:
-				printf("Mouse detached\n");
-				break;
-			case DEVQ_DEVICE_UNKNOWN:
-				printf("Unknown device detached\n");
-				break;
-			}
-			printf("Device path: %s\n", devq_device_get_path(dev));
-			break;
-		case DEVQ_NOTICE:
-			printf("Notice received\n");
-			break;
-		case DEVQ_UNKNOWN:
-			printf("Unknown event\n");
+		}
+		if (devq_event_monitor_dispatch(e, 64) < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			if (errno != 0)
+				warn("devq_event_monitor_dispatch");
 			break;
 		}
-		
-		if (verbose)
-			printf("%s\n", devq_event_dump(ev));
-		devq_event_free(ev);
 	}
 
 	devq_event_monitor_fini(e);
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2014 Baptiste Daroussin <bapt@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer
+ *    in this position and unchanged.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Build the precompiled pci.ids/usb.ids caches used by libdevq to name
+ * devices without parsing the text databases.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libdevq.h>
+
+#include "devq_private.h"
+
+static const char *defaults[] = {
+	DEVQ_PCIIDS_PATH, DEVQ_PCIIDS_CACHE,
+	DEVQ_USBIDS_PATH, DEVQ_USBIDS_CACHE,
+};
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: devq-idscache [ids_file cache_file]\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t i;
+	int ret;
+
+	if (argc == 3) {
+		if (devq_ids_build_cache(argv[1], argv[2]) != 0)
+			err(EXIT_FAILURE, "%s", argv[1]);
+		return (EXIT_SUCCESS);
+	}
+
+	if (argc != 1)
+		usage();
+
+	ret = EXIT_SUCCESS;
+	for (i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i += 2) {
+		if (devq_ids_build_cache(defaults[i], defaults[i + 1]) != 0) {
+			warn("%s", defaults[i]);
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	return (ret);
+}
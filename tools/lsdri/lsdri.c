@@ -41,57 +41,33 @@ int
 print_drm_info(int fd)
 {
 	int ret;
-	int vendor_id, device_id, subvendor_id, subdevice_id, revision_id;
-	char *device_path, *driver_name;
-	size_t device_path_len, driver_name_len;
+	struct devq_drm_info info;
 
-	ret = devq_device_get_devpath_from_fd(fd,
-	    NULL, &device_path_len);
+	ret = devq_device_drm_get_info(fd, &info);
 	if (ret < 0) {
-		fprintf(stderr, "Warning: unable to device path\n");
+		fprintf(stderr, "Warning: Unable to query DRM device\n");
 		return (-1);
 	}
 
-	device_path = malloc(device_path_len);
-	ret = devq_device_get_devpath_from_fd(fd,
-	    device_path, &device_path_len);
-	if (ret < 0) {
-		fprintf(stderr, "Warning: Unable to device path\n");
-		return (-1);
-	}
-
-	printf("%.*s:\n", (int)device_path_len, device_path);
-	free(device_path);
-	device_path = NULL;
-
-	ret = devq_device_drm_get_drvname_from_fd(fd, NULL, &driver_name_len);
-	if (ret < 0) {
-		printf("    Driver name:   Unknown\n");
-		return (-1);
-	}
+	if (info.valid & DEVQ_DRM_INFO_PATH)
+		printf("%s:\n", info.path);
+	else
+		printf("hw.dri.%d:\n", info.dri);
 
-	driver_name = malloc(driver_name_len);
-	ret = devq_device_drm_get_drvname_from_fd(fd,
-	    driver_name, &driver_name_len);
-	if (ret < 0) {
-		fprintf(stderr, "Warning: Unable to determine driver name\n");
-		return (-1);
-	}
+	printf("    Driver name:   %s\n", info.driver);
 
-	printf("    Driver name:   %.*s\n", (int)driver_name_len, driver_name);
-	free(driver_name);
-	driver_name = NULL;
+	if (info.valid & DEVQ_DRM_INFO_BUSADDR)
+		printf("    PCI address:   %04x:%02x:%02x.%x\n",
+		    info.domain, info.bus, info.slot, info.function);
 
-	ret = devq_device_get_pciid_full_from_fd(fd, &vendor_id, &device_id,
-				&subvendor_id, &subdevice_id, &revision_id);
-	if (ret < 0) {
+	if (!(info.valid & DEVQ_DRM_INFO_PCIID)) {
 		fprintf(stderr, "Warning: Unable to determine vendor and device ID\n");
 		return (-1);
 	}
 
-	printf("    PCI vendor ID: 0x%04x subvendor ID: 0x%04x\n", vendor_id, subvendor_id);
-	printf("    PCI device ID: 0x%04x subdevice ID: 0x%04x\n", device_id, subdevice_id);
-	printf("    PCI revision ID: 0x%04x\n", revision_id);
+	printf("    PCI vendor ID: 0x%04x subvendor ID: 0x%04x\n", info.vendor_id, info.subvendor_id);
+	printf("    PCI device ID: 0x%04x subdevice ID: 0x%04x\n", info.device_id, info.subdevice_id);
+	printf("    PCI revision ID: 0x%04x\n", info.revision_id);
 
 	return (0);
 }